@@ -8,9 +8,29 @@
 #ifndef _GOLLD_PROPERTY_TREE_ASSIGN_HPP_
 #define _GOLLD_PROPERTY_TREE_ASSIGN_HPP_
 
+#include <boost/config.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <string>
 
+#include <golld/property_tree/translator.hpp>
+
+#if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES) && !defined(BOOST_NO_CXX11_REF_QUALIFIERS) && \
+    !defined(BOOST_NO_CXX11_FUNCTION_TEMPLATE_DEFAULT_ARGS)
+#include <boost/type_traits/is_same.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <utility>
+#define _GOLLD_PROPERTY_TREE_ASSIGN_MOVE
+// The qualifier of the members which have an overload for temporaries
+#define _GOLLD_PROPERTY_TREE_ASSIGN_LVALUE &
+#else
+#define _GOLLD_PROPERTY_TREE_ASSIGN_LVALUE
+#endif
+
+#if !defined(BOOST_NO_CXX11_VARIADIC_TEMPLATES) && !defined(BOOST_NO_CXX11_CONSTEXPR)
+#include <cstddef>
+#define _GOLLD_PROPERTY_TREE_ASSIGN_LITERAL
+#endif
+
 namespace golld {
 namespace property_tree {
 namespace assign {
@@ -69,6 +89,35 @@ public:
         : ptree_(data)
     { }
 
+#ifdef _GOLLD_PROPERTY_TREE_ASSIGN_MOVE
+    basic_tree(const basic_tree &other)
+        : ptree_(other.ptree_)
+    { }
+
+    /**
+     * @brief Takes the contents of @c other, which is left empty, without
+     * copying them.
+     */
+    basic_tree(basic_tree &&other)
+        : ptree_()
+    {
+        take(this->ptree_, other.ptree_);
+    }
+
+    basic_tree & operator=(const basic_tree &other)
+    {
+        this->ptree_ = other.ptree_;
+        return *this;
+    }
+
+    basic_tree & operator=(basic_tree &&other)
+    {
+        take(this->ptree_, other.ptree_);
+        other.ptree_.clear();
+        return *this;
+    }
+#endif
+
     /**
      * @brief Adds to this basic_tree a subtree @c t under the path @c path.
      *
@@ -77,9 +126,10 @@ public:
      *
      * @return A reference to this basic_tree.
      */
-    basic_tree & operator()(const typename Ptree::path_type &path, const basic_tree &t)
+    basic_tree & operator()(const typename Ptree::path_type &path,
+                            const basic_tree &t) _GOLLD_PROPERTY_TREE_ASSIGN_LVALUE
     {
-        this->ptree_.add_child(path, t.ptree_);
+        this->ptree_.add_child(path, Ptree()) = t.ptree_;
         return *this;
     }
 
@@ -93,9 +143,10 @@ public:
      * @return A reference to this basic_tree.
      */
     template <class Type>
-    basic_tree & operator()(const typename Ptree::path_type &path, const Type &data)
+    basic_tree & operator()(const typename Ptree::path_type &path,
+                            const Type &data) _GOLLD_PROPERTY_TREE_ASSIGN_LVALUE
     {
-        this->ptree_.add(path, data);
+        this->ptree_.add(path, data, translator<Type>());
         return *this;
     }
 
@@ -106,10 +157,9 @@ public:
      *
      * @return A reference to this basic_tree.
      */
-    basic_tree & operator()(const basic_tree &t)
+    basic_tree & operator()(const basic_tree &t) _GOLLD_PROPERTY_TREE_ASSIGN_LVALUE
     {
-        this->ptree_.push_back(std::make_pair(typename Ptree::key_type(),
-                                              static_cast<const Ptree&>(t)));
+        this->push_empty() = t.ptree_;
         return *this;
     }
 
@@ -122,11 +172,9 @@ public:
      * @return A reference to this basic_tree.
      */
     template <class Type>
-    basic_tree & operator()(const Type &data)
+    basic_tree & operator()(const Type &data) _GOLLD_PROPERTY_TREE_ASSIGN_LVALUE
     {
-        Ptree tmp;
-        tmp.put_value(data);
-        this->ptree_.push_back(std::make_pair(typename Ptree::key_type(), tmp));
+        this->push_empty().put_value(data, translator<Type>());
         return *this;
     }
 
@@ -135,7 +183,15 @@ public:
      *
      * @return A Ptree equivalent to this tree.
      */
+#ifdef _GOLLD_PROPERTY_TREE_ASSIGN_MOVE
+    // A template, so that the moving conversion is chosen for a temporary
+    // converted to a Ptree, while a temporary still binds to a Ptree
+    // reference, as in pt.swap(tree()(1)).
+    template <class T, class = typename boost::enable_if<boost::is_same<T, Ptree> >::type>
+    operator const T&() const
+#else
     operator const Ptree&() const
+#endif
     {
         return this->ptree_;
     }
@@ -145,17 +201,355 @@ public:
      *
      * @return A Ptree equivalent to this tree.
      */
+#ifdef _GOLLD_PROPERTY_TREE_ASSIGN_MOVE
+    template <class T, class = typename boost::enable_if<boost::is_same<T, Ptree> >::type>
+    operator T&()
+#else
     operator Ptree&()
+#endif
     {
         return this->ptree_;
     }
 
+#ifdef _GOLLD_PROPERTY_TREE_ASSIGN_MOVE
+    /**
+     * @brief Moves to this basic_tree a temporary subtree @c t under the path
+     * @c path.
+     */
+    basic_tree & operator()(const typename Ptree::path_type &path, basic_tree &&t) &
+    {
+        take(this->ptree_.add_child(path, Ptree()), t.ptree_);
+        return *this;
+    }
+
+    /**
+     * @brief Moves to this basic_tree a temporary subtree @c t under an empty path.
+     */
+    basic_tree & operator()(basic_tree &&t) &
+    {
+        take(this->push_empty(), t.ptree_);
+        return *this;
+    }
+
+    /*
+     * On a temporary basic_tree, as in tree()(...)(...), each operator()
+     * returns an rvalue reference, so that a nested builder expression is
+     * moved into its parent instead of copied. Building a tree of N nodes
+     * then copies no subtree.
+     */
+
+    basic_tree && operator()(const typename Ptree::path_type &path, const basic_tree &t) &&
+    {
+        return std::move((*this)(path, t));
+    }
+
+    basic_tree && operator()(const typename Ptree::path_type &path, basic_tree &&t) &&
+    {
+        return std::move((*this)(path, std::move(t)));
+    }
+
+    template <class Type>
+    basic_tree && operator()(const typename Ptree::path_type &path, const Type &data) &&
+    {
+        return std::move((*this)(path, data));
+    }
+
+    basic_tree && operator()(const basic_tree &t) &&
+    {
+        return std::move((*this)(t));
+    }
+
+    basic_tree && operator()(basic_tree &&t) &&
+    {
+        return std::move((*this)(std::move(t)));
+    }
+
+    template <class Type>
+    basic_tree && operator()(const Type &data) &&
+    {
+        return std::move((*this)(data));
+    }
+
+    /**
+     * @brief Converts a temporary basic_tree to a Ptree, taking its contents
+     * without copying them.
+     *
+     * @return A Ptree equivalent to this tree.
+     */
+    operator Ptree() &&
+    {
+        Ptree result;
+        take(result, this->ptree_);
+        return result;
+    }
+#endif
+
 private:
+    // The children are created empty in their final place and then filled, so
+    // a subtree is copied at most once, and a temporary one is not copied.
+    Ptree & push_empty()
+    {
+        return this->ptree_.push_back(
+            typename Ptree::value_type(typename Ptree::key_type(), Ptree()))->second;
+    }
+
+#ifdef _GOLLD_PROPERTY_TREE_ASSIGN_MOVE
+    // Only data of equal allocators can be swapped: strings of different
+    // std::pmr resources cannot.
+    template <class Data>
+    static bool swappable(const Data &, const Data &)
+    {
+        return true;
+    }
+
+    template <class Ch, class Traits, class Alloc>
+    static bool swappable(const std::basic_string<Ch, Traits, Alloc> &a,
+                          const std::basic_string<Ch, Traits, Alloc> &b)
+    {
+        return a.get_allocator() == b.get_allocator();
+    }
+
+    // Puts the contents of from in to, without copying them when they can
+    // be swapped. Otherwise they are copied member by member, since the
+    // basic_ptree assignment swaps too.
+    static void take(Ptree &to, Ptree &from)
+    {
+        if (swappable(to.data(), from.data())) {
+            to.swap(from);
+        }
+        else {
+            to.clear();
+            to.data() = from.data();
+            to.insert(to.end(), from.begin(), from.end());
+        }
+    }
+#endif
+
+    // The numbers are written without building a stream
+    template <class Type>
+    static typename translator_for<typename Ptree::data_type, Type>::type translator()
+    {
+        return typename translator_for<typename Ptree::data_type, Type>::type();
+    }
+
     Ptree ptree_;
 };
 
 typedef basic_tree<boost::property_tree::ptree> tree;
 
+#ifdef _GOLLD_PROPERTY_TREE_ASSIGN_LITERAL
+
+// The key of an entry without key.
+struct no_key
+{ };
+
+template <class Ptree>
+typename Ptree::key_type make_key(no_key)
+{
+    return typename Ptree::key_type();
+}
+
+template <class Ptree, class Ch>
+typename Ptree::key_type make_key(const Ch *key)
+{
+    return typename Ptree::key_type(key);
+}
+
+template <class Ptree>
+Ptree & push_literal_child(Ptree &pt, const typename Ptree::key_type &key)
+{
+    return pt.push_back(typename Ptree::value_type(key, Ptree()))->second;
+}
+
+// The children of a basic_literal, as a recursive list.
+template <class... Entries>
+struct literal_list;
+
+template <>
+struct literal_list<>
+{
+    static const std::size_t node_count = 0;
+
+    constexpr literal_list()
+    { }
+
+    template <class Ptree>
+    void build(Ptree &) const
+    { }
+};
+
+template <class Head, class... Tail>
+struct literal_list<Head, Tail...>
+{
+    static const std::size_t node_count = Head::node_count + literal_list<Tail...>::node_count;
+
+    constexpr literal_list(const Head &head, const Tail &...tail)
+        : head(head)
+        , tail(tail...)
+    { }
+
+    template <class Ptree>
+    void build(Ptree &pt) const
+    {
+        head.build(pt);
+        tail.build(pt);
+    }
+
+    Head head;
+    literal_list<Tail...> tail;
+};
+
+/**
+ * @brief A tree whose shape is known at compile time.
+ *
+ * Made by the literal function, it holds its keys and values with their
+ * original types, and can be a constexpr variable with static storage. The
+ * number of nodes of the tree, itself included, is the constant node_count.
+ *
+ * A Ptree is built from it in a single pass, each node being created in its
+ * final place; no subtree is copied and no value is formatted twice.
+ */
+template <class... Entries>
+class basic_literal
+{
+public:
+    static const std::size_t node_count = 1 + literal_list<Entries...>::node_count;
+
+    constexpr explicit basic_literal(const Entries &...entries)
+        : entries_(entries...)
+    { }
+
+    /**
+     * @brief Adds the entries of this literal as children of @c pt.
+     */
+    template <class Ptree>
+    void build(Ptree &pt) const
+    {
+        entries_.build(pt);
+    }
+
+    /**
+     * @brief Builds a Ptree with the entries of this literal as children.
+     */
+    template <class Ptree>
+    Ptree build() const
+    {
+        Ptree pt;
+        entries_.build(pt);
+        return pt;
+    }
+
+private:
+    literal_list<Entries...> entries_;
+};
+
+// An entry with a value.
+template <class Key, class Value>
+struct literal_value
+{
+    static const std::size_t node_count = 1;
+
+    constexpr literal_value(const Key &key, const Value &value)
+        : key(key)
+        , value(value)
+    { }
+
+    template <class Ptree>
+    void build(Ptree &pt) const
+    {
+        typedef typename translator_for<typename Ptree::data_type, Value>::type Translator;
+        push_literal_child(pt, make_key<Ptree>(key)).put_value(value, Translator());
+    }
+
+    Key key;
+    Value value;
+};
+
+// An entry with a subtree.
+template <class Key, class... Entries>
+struct literal_subtree
+{
+    static const std::size_t node_count = basic_literal<Entries...>::node_count;
+
+    constexpr literal_subtree(const Key &key, const basic_literal<Entries...> &tree)
+        : key(key)
+        , tree(tree)
+    { }
+
+    template <class Ptree>
+    void build(Ptree &pt) const
+    {
+        tree.build(push_literal_child(pt, make_key<Ptree>(key)));
+    }
+
+    Key key;
+    basic_literal<Entries...> tree;
+};
+
+/**
+ * @brief Makes a compile time tree with the given entries.
+ *
+ * The same tree as the basic_tree example can be written as:
+ * \code
+ * constexpr auto defaults = literal(
+ *     entry("key1", "value1"),
+ *     entry("key2", literal(
+ *         entry("key3", 12345),
+ *         entry(literal(
+ *             entry("key4", "value4 with spaces"))),
+ *         entry("key5", "value5"),
+ *         entry(10), entry(11), entry(12))));
+ *
+ * boost::property_tree::ptree pt = defaults.build<boost::property_tree::ptree>();
+ * \endcode
+ *
+ * @param entries The entries made by the entry functions.
+ */
+template <class... Entries>
+constexpr basic_literal<Entries...> literal(const Entries &...entries)
+{
+    return basic_literal<Entries...>(entries...);
+}
+
+/**
+ * @brief Makes an entry of a literal with key @c key and value @c value.
+ */
+template <class Ch, class Value>
+constexpr literal_value<const Ch*, Value> entry(const Ch *key, Value value)
+{
+    return literal_value<const Ch*, Value>(key, value);
+}
+
+/**
+ * @brief Makes an entry of a literal with key @c key and subtree @c tree.
+ */
+template <class Ch, class... Entries>
+constexpr literal_subtree<const Ch*, Entries...> entry(const Ch *key,
+                                                       const basic_literal<Entries...> &tree)
+{
+    return literal_subtree<const Ch*, Entries...>(key, tree);
+}
+
+/**
+ * @brief Makes an entry of a literal with an empty key and value @c value.
+ */
+template <class Value>
+constexpr literal_value<no_key, Value> entry(Value value)
+{
+    return literal_value<no_key, Value>(no_key(), value);
+}
+
+/**
+ * @brief Makes an entry of a literal with an empty key and subtree @c tree.
+ */
+template <class... Entries>
+constexpr literal_subtree<no_key, Entries...> entry(const basic_literal<Entries...> &tree)
+{
+    return literal_subtree<no_key, Entries...>(no_key(), tree);
+}
+
+#endif
+
 } // namespace assign
 } // namespace property_tree
 } // namespace golld
@@ -9,35 +9,204 @@
 #define _GOLLD_PROPERTY_TREE_CONVERSION_HPP_
 
 #include <boost/array.hpp>
+#include <boost/config.hpp>
 #include <boost/foreach.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/iterator/transform_iterator.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/is_same.hpp>
 #include <algorithm>
+#include <cstddef>
+#include <functional>
 #include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include <golld/property_tree/translator.hpp>
+
+#if !defined(BOOST_NO_CXX11_HDR_THREAD) && !defined(BOOST_NO_CXX11_SMART_PTR)
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <system_error>
+#include <thread>
+#define _GOLLD_PROPERTY_TREE_CONVERSION_PARALLEL
+#endif
 
 namespace golld {
 namespace property_tree {
 
+/**
+ * @brief A child of a ptree, as seen by items: a reference to its key in the
+ * tree and its converted data.
+ */
+template <class Key, class T>
+struct key_value
+{
+    key_value(const Key &first, const T &second)
+        : first(first)
+        , second(second)
+    { }
+
+    const Key &first;
+    T second;
+};
+
 namespace detail {
 
 template <class T, class Ptree>
 struct pair2data
-    : public std::unary_function<const typename Ptree::value_type, T>
 {
+    typedef const typename Ptree::value_type argument_type;
+    typedef T result_type;
+
     T operator()(const typename Ptree::value_type &pair) const
     {
-        return pair.second.template get_value<T>();
+        typedef typename translator_for<typename Ptree::data_type, T>::type Translator;
+        return pair.second.template get_value<T>(Translator());
+    }
+};
+
+template <class Ptree>
+struct pair2key
+{
+    typedef const typename Ptree::value_type argument_type;
+    typedef const typename Ptree::key_type &result_type;
+
+    result_type operator()(const typename Ptree::value_type &pair) const
+    {
+        return pair.first;
+    }
+};
+
+template <class T, class Ptree>
+struct pair2item
+{
+    typedef const typename Ptree::value_type argument_type;
+    typedef key_value<typename Ptree::key_type, T> result_type;
+
+    result_type operator()(const typename Ptree::value_type &pair) const
+    {
+        return result_type(pair.first, pair2data<T, Ptree>()(pair));
+    }
+};
+
+// The range of the children of a Ptree seen through Function.
+template <class Function, class Ptree>
+struct transformed_children
+{
+    typedef boost::transform_iterator<Function, typename Ptree::const_iterator> iterator;
+    typedef boost::iterator_range<iterator> type;
+
+    static type make(const Ptree &pt)
+    {
+        return type(iterator(pt.begin(), Function()), iterator(pt.end(), Function()));
     }
 };
 
+// Whether the children of a Ptree can be decoded to T in bulk, that is,
+// whether arithmetic_translator is the translator between them.
+template <class T, class Ptree>
+struct is_bulk_decodable
+    : boost::is_same<typename translator_for<typename Ptree::data_type, T>::type,
+                     arithmetic_translator<typename Ptree::data_type, T> >
+{ };
+
+// Builds the ptree_bad_data error for the children at the bad indices. The
+// indices are the data of the error, and the first ones are in its message.
+template <class T>
+boost::property_tree::ptree_bad_data
+bad_children_error(const std::vector<std::size_t> &bad)
+{
+    static const std::size_t max_listed = 10;
+
+    std::string what = std::string("conversion of data to type \"") + typeid(T).name() +
+        "\" failed at the children ";
+    for (std::size_t i = 0; i < bad.size() && i < max_listed; ++i) {
+        char buffer[number_buffer_size];
+        if (i != 0) {
+            what += ", ";
+        }
+        what.append(buffer, format_integer(bad[i], buffer));
+    }
+    if (bad.size() > max_listed) {
+        what += ", ...";
+    }
+
+    return boost::property_tree::ptree_bad_data(what, bad);
 }
 
+// Parses the data of the children in [first, last) straight to out. The
+// indices of the children which are not a T are appended to bad, counting
+// from index at first.
+template <class T, class Iterator, class OutputIterator>
+void decode_range(Iterator first, Iterator last, std::size_t index,
+                  OutputIterator out, std::vector<std::size_t> &bad)
+{
+    for (; first != last; ++first, ++out, ++index) {
+        const typename Iterator::value_type::second_type::data_type &data = first->second.data();
+        T value = T();
+        if (!parse_number(data.data(), data.data() + data.size(), value)) {
+            bad.push_back(index);
+        }
+        *out = value;
+    }
+}
+
+// Parses the data of every child of pt straight to out, which has room for
+// all of them. The children which are not a T are all reported together, in
+// a ptree_bad_data holding the vector of their indices.
+template <class T, class Ptree, class OutputIterator>
+void decode_children(const Ptree &pt, OutputIterator out)
+{
+    std::vector<std::size_t> bad;
+    decode_range<T>(pt.begin(), pt.end(), 0, out, bad);
+
+    if (!bad.empty()) {
+        throw bad_children_error<T>(bad);
+    }
+}
+
+// Decodes the children of a ptree to a Sequence, through a vector holding
+// all the values.
 template <class Sequence>
-Sequence toSequence(const boost::property_tree::ptree &ptree)
+struct sequence_decoder
+{
+    template <class Ptree>
+    static Sequence decode(const Ptree &pt)
+    {
+        std::vector<typename Sequence::value_type> values(pt.size());
+        decode_children<typename Sequence::value_type>(pt, values.begin());
+        return Sequence(values.begin(), values.end());
+    }
+};
+
+// A vector is allocated once and decoded into in place.
+template <class T, class Alloc>
+struct sequence_decoder<std::vector<T, Alloc> >
+{
+    template <class Ptree>
+    static std::vector<T, Alloc> decode(const Ptree &pt)
+    {
+        std::vector<T, Alloc> values(pt.size());
+        decode_children<T>(pt, values.begin());
+        return values;
+    }
+};
+
+template <class Sequence, class Ptree>
+Sequence to_sequence(const Ptree &ptree, boost::true_type)
+{
+    return sequence_decoder<Sequence>::decode(ptree);
+}
+
+template <class Sequence, class Ptree>
+Sequence to_sequence(const Ptree &ptree, boost::false_type)
 {
-    namespace bpt = boost::property_tree;
-    typedef detail::pair2data<typename Sequence::value_type, bpt::ptree> Concrete_pair2data;
-    typedef boost::transform_iterator<Concrete_pair2data, bpt::ptree::const_iterator> Iterator;
+    typedef pair2data<typename Sequence::value_type, Ptree> Concrete_pair2data;
+    typedef boost::transform_iterator<Concrete_pair2data, typename Ptree::const_iterator> Iterator;
 
     const Iterator begin(ptree.begin(), Concrete_pair2data());
     const Iterator end(ptree.end(), Concrete_pair2data());
@@ -45,26 +214,345 @@ Sequence toSequence(const boost::property_tree::ptree &ptree)
     return Sequence(begin, end);
 }
 
+template <class T, std::size_t N, class Ptree>
+void to_array(const Ptree &ptree, boost::array<T, N> &array, boost::true_type)
+{
+    decode_children<T>(ptree, array.begin());
+}
+
+template <class T, std::size_t N, class Ptree>
+void to_array(const Ptree &ptree, boost::array<T, N> &array, boost::false_type)
+{
+    typedef pair2data<T, Ptree> Concrete_pair2data;
+    typedef boost::transform_iterator<Concrete_pair2data, typename Ptree::const_iterator> Iterator;
+
+    const Iterator begin(ptree.begin(), Concrete_pair2data());
+    const Iterator end(ptree.end(), Concrete_pair2data());
+
+    std::copy(begin, end, array.begin());
+}
+
+}
+
+/**
+ * @brief Converts the data of the children of a ptree to a sequence.
+ *
+ * Works with any basic_ptree instantiation. When the values are numbers or
+ * bools and the data are char strings, the children are parsed in one pass
+ * into the sequence, and the ptree_bad_data thrown names all the malformed
+ * children: its data is a std::vector<std::size_t> with their indices.
+ */
+template <class Sequence, class Key, class Data, class Compare>
+Sequence toSequence(const boost::property_tree::basic_ptree<Key, Data, Compare> &ptree)
+{
+    typedef boost::property_tree::basic_ptree<Key, Data, Compare> Ptree;
+    typedef detail::is_bulk_decodable<typename Sequence::value_type, Ptree> Bulk;
+
+    return detail::to_sequence<Sequence>(ptree, boost::integral_constant<bool, Bulk::value>());
+}
+
+template <class Sequence>
+Sequence toSequence(const boost::property_tree::ptree &ptree)
+{
+    return toSequence<Sequence, std::string, std::string, std::less<std::string> >(ptree);
+}
+
+/**
+ * @brief Converts the data of the N children of a ptree to an array.
+ *
+ * Works with any basic_ptree instantiation. Numbers and bools are decoded
+ * in bulk, as by toSequence.
+ */
+template <class T, std::size_t N, class Key, class Data, class Compare>
+boost::array<T, N> toArray(const boost::property_tree::basic_ptree<Key, Data, Compare> &ptree)
+{
+    typedef boost::property_tree::basic_ptree<Key, Data, Compare> Ptree;
+    typedef detail::is_bulk_decodable<T, Ptree> Bulk;
+
+    if (ptree.size() != N) {
+        throw std::range_error("Array size error.");
+    }
+
+    boost::array<T, N> tmpArray;
+    detail::to_array(ptree, tmpArray, boost::integral_constant<bool, Bulk::value>());
+
+    return tmpArray;
+}
+
 template <class T, std::size_t N>
 boost::array<T, N> toArray(const boost::property_tree::ptree &ptree)
 {
-    namespace bpt = boost::property_tree;
-    typedef detail::pair2data<T, bpt::ptree> Concrete_pair2data;
-    typedef boost::transform_iterator<Concrete_pair2data, bpt::ptree::const_iterator> Iterator;
+    return toArray<T, N, std::string, std::string, std::less<std::string> >(ptree);
+}
+
+/**
+ * @brief A lazy range over the data of the children of a ptree, converted
+ * to T as each one is dereferenced.
+ *
+ * Nothing is allocated, and a conversion error is thrown when the element is
+ * reached. The range can go through the Boost.Range adaptors, as filtered or
+ * reversed, and through the C++20 views.
+ *
+ * Its iterators have bidirectional traversal, but return the values by copy,
+ * so to the standard library they are input iterators. A part of the range
+ * is taken with boost::next and boost::prior, which follow the traversal:
+ * boost::make_iterator_range(boost::next(range.begin()), boost::prior(range.end())).
+ *
+ * @code
+ * BOOST_FOREACH(double value, values<double>(pt)) { ... }
+ * @endcode
+ */
+template <class T, class Key, class Data, class Compare>
+typename detail::transformed_children<
+    detail::pair2data<T, boost::property_tree::basic_ptree<Key, Data, Compare> >,
+    boost::property_tree::basic_ptree<Key, Data, Compare> >::type
+values(const boost::property_tree::basic_ptree<Key, Data, Compare> &ptree)
+{
+    typedef boost::property_tree::basic_ptree<Key, Data, Compare> Ptree;
+    return detail::transformed_children<detail::pair2data<T, Ptree>, Ptree>::make(ptree);
+}
+
+/**
+ * @brief A lazy range over the keys of the children of a ptree, referred to
+ * in the tree.
+ */
+template <class Key, class Data, class Compare>
+typename detail::transformed_children<
+    detail::pair2key<boost::property_tree::basic_ptree<Key, Data, Compare> >,
+    boost::property_tree::basic_ptree<Key, Data, Compare> >::type
+keys(const boost::property_tree::basic_ptree<Key, Data, Compare> &ptree)
+{
+    typedef boost::property_tree::basic_ptree<Key, Data, Compare> Ptree;
+    return detail::transformed_children<detail::pair2key<Ptree>, Ptree>::make(ptree);
+}
+
+/**
+ * @brief A lazy range over the children of a ptree as key_value, with the
+ * data converted to T as values does.
+ */
+template <class T, class Key, class Data, class Compare>
+typename detail::transformed_children<
+    detail::pair2item<T, boost::property_tree::basic_ptree<Key, Data, Compare> >,
+    boost::property_tree::basic_ptree<Key, Data, Compare> >::type
+items(const boost::property_tree::basic_ptree<Key, Data, Compare> &ptree)
+{
+    typedef boost::property_tree::basic_ptree<Key, Data, Compare> Ptree;
+    return detail::transformed_children<detail::pair2item<T, Ptree>, Ptree>::make(ptree);
+}
+
+#ifdef _GOLLD_PROPERTY_TREE_CONVERSION_PARALLEL
+
+namespace detail {
+
+// The fewest children worth a thread of their own.
+const std::size_t parallel_min_chunk = 16384;
+
+// The outcome of converting a chunk of children.
+struct chunk_outcome
+{
+    // The indices of the malformed children, in bulk decoding
+    std::vector<std::size_t> bad;
+
+    // The exception which stopped the chunk, if any
+    std::exception_ptr failure;
+};
+
+template <class T, class Ptree, class OutputIterator>
+void convert_chunk(typename Ptree::const_iterator first, typename Ptree::const_iterator last,
+                   std::size_t index, OutputIterator out, chunk_outcome &outcome,
+                   boost::true_type)
+{
+    decode_range<T>(first, last, index, out, outcome.bad);
+}
+
+// Stops at the first child which cannot be converted, as toSequence does.
+template <class T, class Ptree, class OutputIterator>
+void convert_chunk(typename Ptree::const_iterator first, typename Ptree::const_iterator last,
+                   std::size_t, OutputIterator out, chunk_outcome &,
+                   boost::false_type)
+{
+    std::transform(first, last, out, pair2data<T, Ptree>());
+}
+
+template <class T, class Ptree, class OutputIterator>
+void convert_chunk_worker(typename Ptree::const_iterator first,
+                          typename Ptree::const_iterator last,
+                          std::size_t index, OutputIterator out, chunk_outcome &outcome)
+{
+    typedef is_bulk_decodable<T, Ptree> Bulk;
+
+    try {
+        convert_chunk<T, Ptree>(first, last, index, out, outcome,
+                                boost::integral_constant<bool, Bulk::value>());
+    }
+    catch (...) {
+        outcome.failure = std::current_exception();
+    }
+}
+
+// Converts the children of pt to out, a random access iterator with room for
+// all of them, in chunks on up to threads threads. The chunks are handed out
+// while the children are walked, so the first ones start before the walk
+// ends. The calling thread converts the last chunk.
+//
+// The errors are reported as if the children were converted in order: the
+// exception of the first failed chunk, or else all the malformed children
+// of a bulk decoding.
+template <class T, class Ptree, class OutputIterator>
+void parallel_convert(const Ptree &pt, OutputIterator out, std::size_t threads)
+{
+    typedef typename Ptree::const_iterator Iterator;
+
+    const std::size_t size = pt.size();
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    const std::size_t chunks = std::max<std::size_t>(
+        std::min(threads, size / parallel_min_chunk), 1);
+
+    std::vector<chunk_outcome> outcomes(chunks);
+    std::vector<std::thread> workers;
+    workers.reserve(chunks - 1);
+
+    Iterator first = pt.begin();
+    std::size_t index = 0;
+    for (std::size_t i = 0; i < chunks; ++i) {
+        const std::size_t chunk_size = size / chunks + (i < size % chunks ? 1 : 0);
+        Iterator last = first;
+        std::advance(last, chunk_size);
+
+        bool started = false;
+        if (i + 1 < chunks) {
+            try {
+                workers.push_back(std::thread(&convert_chunk_worker<T, Ptree, OutputIterator>,
+                                              first, last, index, out + index,
+                                              std::ref(outcomes[i])));
+                started = true;
+            }
+            catch (const std::system_error &) {
+                // Convert the chunk here instead
+            }
+        }
+        if (!started) {
+            convert_chunk_worker<T, Ptree>(first, last, index, out + index, outcomes[i]);
+        }
+
+        first = last;
+        index += chunk_size;
+    }
 
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+
+    std::vector<std::size_t> bad;
+    for (std::size_t i = 0; i < chunks; ++i) {
+        if (outcomes[i].failure) {
+            std::rethrow_exception(outcomes[i].failure);
+        }
+        bad.insert(bad.end(), outcomes[i].bad.begin(), outcomes[i].bad.end());
+    }
+    if (!bad.empty()) {
+        throw bad_children_error<T>(bad);
+    }
+}
+
+// Converts the children of a ptree to a Sequence, through an array holding
+// all the values.
+template <class Sequence>
+struct parallel_sequence_converter
+{
+    template <class Ptree>
+    static Sequence convert(const Ptree &pt, std::size_t threads)
+    {
+        typedef typename Sequence::value_type T;
+
+        const std::unique_ptr<T[]> values(new T[pt.size()]());
+        parallel_convert<T>(pt, values.get(), threads);
+        return Sequence(values.get(), values.get() + pt.size());
+    }
+};
+
+// A vector is allocated once and converted into in place.
+template <class T, class Alloc>
+struct parallel_sequence_converter<std::vector<T, Alloc> >
+{
+    template <class Ptree>
+    static std::vector<T, Alloc> convert(const Ptree &pt, std::size_t threads)
+    {
+        std::vector<T, Alloc> values(pt.size());
+        parallel_convert<T>(pt, values.begin(), threads);
+        return values;
+    }
+};
+
+// The bits of a vector<bool> share words, so the chunks cannot write there.
+template <class Alloc>
+struct parallel_sequence_converter<std::vector<bool, Alloc> >
+{
+    template <class Ptree>
+    static std::vector<bool, Alloc> convert(const Ptree &pt, std::size_t threads)
+    {
+        const std::unique_ptr<bool[]> values(new bool[pt.size()]());
+        parallel_convert<bool>(pt, values.get(), threads);
+        return std::vector<bool, Alloc>(values.get(), values.get() + pt.size());
+    }
+};
+
+}
+
+/**
+ * @brief Converts the data of the children of a ptree to a sequence, as
+ * toSequence, splitting the children among threads.
+ *
+ * Each thread converts a contiguous chunk of the children into a buffer
+ * allocated beforehand. The error thrown is the one toSequence would throw:
+ * that of the first child in error, or the ptree_bad_data naming all the
+ * malformed children of a bulk decoding.
+ *
+ * @param threads The most threads used, the calling one included. If 0, the
+ * number of hardware threads. Small ptrees are converted by fewer threads.
+ */
+template <class Sequence, class Key, class Data, class Compare>
+Sequence parallelToSequence(const boost::property_tree::basic_ptree<Key, Data, Compare> &ptree,
+                            std::size_t threads = 0)
+{
+    return detail::parallel_sequence_converter<Sequence>::convert(ptree, threads);
+}
+
+template <class Sequence>
+Sequence parallelToSequence(const boost::property_tree::ptree &ptree, std::size_t threads = 0)
+{
+    return parallelToSequence<Sequence, std::string, std::string, std::less<std::string> >(
+        ptree, threads);
+}
+
+/**
+ * @brief Converts the data of the N children of a ptree to an array, as
+ * toArray, splitting the children among threads as parallelToSequence.
+ */
+template <class T, std::size_t N, class Key, class Data, class Compare>
+boost::array<T, N> parallelToArray(const boost::property_tree::basic_ptree<Key, Data, Compare> &ptree,
+                                   std::size_t threads = 0)
+{
     if (ptree.size() != N) {
         throw std::range_error("Array size error.");
     }
 
-    const Iterator begin(ptree.begin(), Concrete_pair2data());
-    const Iterator end(ptree.end(), Concrete_pair2data());
-
     boost::array<T, N> tmpArray;
-    std::copy(begin, end, tmpArray.begin());
+    detail::parallel_convert<T>(ptree, tmpArray.begin(), threads);
 
     return tmpArray;
 }
 
+template <class T, std::size_t N>
+boost::array<T, N> parallelToArray(const boost::property_tree::ptree &ptree, std::size_t threads = 0)
+{
+    return parallelToArray<T, N, std::string, std::string, std::less<std::string> >(ptree, threads);
+}
+
+#endif
+
 template<class Ptree>
 Ptree graphUnion(const Ptree& pt1, const Ptree& pt2)
 {
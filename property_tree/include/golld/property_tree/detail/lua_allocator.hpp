@@ -0,0 +1,212 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_DETAIL_LUA_ALLOCATOR_HPP_
+#define _GOLLD_PROPERTY_TREE_DETAIL_LUA_ALLOCATOR_HPP_
+
+#include <boost/noncopyable.hpp>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+extern "C"
+{
+#include <lua.h>
+}
+
+namespace golld {
+namespace property_tree {
+namespace lua_parser {
+
+// The lua_Alloc function used by the states created from a lua_parse_options.
+//
+// In arena mode, memory is taken from large blocks with a bump pointer and is
+// never given back to them. The blocks are all freed at once when the
+// allocator is destroyed, after lua_close. In heap mode, the C heap is used.
+//
+// In both modes a memory limit can be set. It is enforced only inside a
+// limit_scope, so that the unprotected API calls made by the parser do not
+// fail after a script used all the memory it was allowed to.
+class lua_allocator
+    : private boost::noncopyable
+{
+public:
+    lua_allocator(bool arena, std::size_t limit)
+        : arena_(arena)
+        , limit_(limit)
+        , limited_(false)
+        , used_(0)
+        , blocks_(NULL)
+        , top_(NULL)
+        , end_(NULL)
+        , last_(NULL)
+    { }
+
+    ~lua_allocator()
+    {
+        while (blocks_ != NULL) {
+            char *next = *reinterpret_cast<char**>(blocks_);
+            std::free(blocks_);
+            blocks_ = next;
+        }
+    }
+
+    static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+    {
+        lua_allocator *self = static_cast<lua_allocator*>(ud);
+        if (self->arena_) {
+            return self->arena_alloc(ptr, osize, nsize);
+        }
+        else {
+            return self->heap_alloc(ptr, osize, nsize);
+        }
+    }
+
+    // Enforces the memory limit of the state allocator, if it is a lua_allocator.
+    class limit_scope
+        : private boost::noncopyable
+    {
+    public:
+        explicit limit_scope(lua_State *L)
+            : allocator_(NULL)
+        {
+            void *ud;
+            if (lua_getallocf(L, &ud) == &lua_allocator::alloc) {
+                allocator_ = static_cast<lua_allocator*>(ud);
+                allocator_->limited_ = true;
+            }
+        }
+
+        ~limit_scope()
+        {
+            if (allocator_ != NULL) {
+                allocator_->limited_ = false;
+            }
+        }
+
+    private:
+        lua_allocator *allocator_;
+    };
+
+private:
+    static const std::size_t alignment = 16;
+    static const std::size_t block_size = 65536;
+
+    static std::size_t align(std::size_t size)
+    {
+        return (size + alignment - 1) & ~(alignment - 1);
+    }
+
+    bool exceeds(std::size_t size) const
+    {
+        return limited_ && limit_ != 0 && used_ + size > limit_;
+    }
+
+    void *heap_alloc(void *ptr, size_t osize, size_t nsize)
+    {
+        if (nsize == 0) {
+            std::free(ptr);
+            used_ -= osize;
+            return NULL;
+        }
+
+        if (nsize > osize && exceeds(nsize - osize)) {
+            return NULL;
+        }
+
+        void *p = std::realloc(ptr, nsize);
+        if (p != NULL) {
+            used_ = used_ - osize + nsize;
+        }
+        return p;
+    }
+
+    void *arena_alloc(void *ptr, size_t osize, size_t nsize)
+    {
+        // Memory is only given back with the whole arena
+        if (nsize == 0) {
+            return NULL;
+        }
+        if (nsize <= osize) {
+            return ptr;
+        }
+
+        const std::size_t size = align(nsize);
+
+        // The last allocation can grow in place
+        if (ptr != NULL && ptr == last_ &&
+            size <= static_cast<std::size_t>(end_ - static_cast<char*>(ptr))) {
+            top_ = static_cast<char*>(ptr) + size;
+            return ptr;
+        }
+
+        void *p = bump(size);
+        if (p != NULL && ptr != NULL) {
+            std::memcpy(p, ptr, osize);
+        }
+        return p;
+    }
+
+    void *bump(std::size_t size)
+    {
+        // Large allocations have their own block, keeping the current one
+        if (size > block_size / 4) {
+            char *block = new_block(size);
+            return block == NULL ? NULL : block + alignment;
+        }
+
+        if (size > static_cast<std::size_t>(end_ - top_)) {
+            char *block = new_block(block_size - alignment);
+            if (block == NULL) {
+                return NULL;
+            }
+            top_ = block + alignment;
+            end_ = block + block_size;
+        }
+
+        last_ = top_;
+        top_ += size;
+        return last_;
+    }
+
+    // A block with room for size bytes after its header, which links it to
+    // the other blocks.
+    char *new_block(std::size_t size)
+    {
+        size += alignment;
+        if (exceeds(size)) {
+            return NULL;
+        }
+
+        char *block = static_cast<char*>(std::malloc(size));
+        if (block == NULL) {
+            return NULL;
+        }
+
+        *reinterpret_cast<char**>(block) = blocks_;
+        blocks_ = block;
+        used_ += size;
+
+        return block;
+    }
+
+    const bool arena_;
+    const std::size_t limit_;
+    bool limited_;
+    std::size_t used_;
+
+    char *blocks_;
+    char *top_;
+    char *end_;
+    void *last_;
+};
+
+} // namespace lua_parser
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_DETAIL_LUA_ALLOCATOR_HPP_ */
@@ -0,0 +1,241 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_DETAIL_LUA_CHUNK_CACHE_HPP_
+#define _GOLLD_PROPERTY_TREE_DETAIL_LUA_CHUNK_CACHE_HPP_
+
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "lua_parser_error.hpp"
+
+extern "C"
+{
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+namespace golld {
+namespace property_tree {
+namespace lua_parser {
+
+/**
+ * @brief A cache of compiled Lua chunks.
+ *
+ * The chunks are kept as Lua bytecode, keyed by the file path, and are valid
+ * while the file modification time and size are unchanged. Optionally the
+ * bytecode is also persisted in a directory, so it survives the process.
+ *
+ * Lua does not verify the loaded bytecode, thus the cache directory must be
+ * writable only by trusted users.
+ */
+class lua_chunk_cache
+    : private boost::noncopyable
+{
+public:
+    /**
+     * @brief Constructs a cache held only in memory.
+     */
+    lua_chunk_cache()
+        : directory_()
+    { }
+
+    /**
+     * @brief Constructs a cache held in memory and persisted in @c directory.
+     *
+     * @param directory An existing directory where the bytecode files will be
+     * written.
+     */
+    explicit lua_chunk_cache(const std::string &directory)
+        : directory_(directory)
+    { }
+
+    /**
+     * @brief Pushes onto the stack of @c L the compiled chunk of a Lua file.
+     *
+     * The file is compiled only if there is no valid bytecode for it in the
+     * cache.
+     *
+     * @param L The Lua state where the chunk will be loaded.
+     * @param filename The Lua script file.
+     */
+    void load(lua_State *L, const std::string &filename)
+    {
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0) {
+            throw lua_parser_error("cannot open file", filename);
+        }
+
+        const file_stamp stamp(st.st_mtime, st.st_size);
+        const std::string chunkname = "@" + filename;
+
+        bytecode_ptr bytecode = find(filename, stamp);
+        if (bytecode &&
+            luaL_loadbuffer(L, bytecode->data(), bytecode->size(), chunkname.c_str()) == 0) {
+            return;
+        }
+        if (bytecode) {
+            lua_pop(L, 1);
+        }
+
+        std::ifstream stream(filename.c_str(), std::ios_base::binary);
+        if (!stream) {
+            throw lua_parser_error("cannot open file", filename);
+        }
+        const std::string source((std::istreambuf_iterator<char>(stream)),
+                                 std::istreambuf_iterator<char>());
+        if (stream.bad()) {
+            throw lua_parser_error("read error", filename);
+        }
+
+        if (luaL_loadbuffer(L, source.data(), source.size(), chunkname.c_str())) {
+            std::string desc(lua_tostring(L, -1));
+            lua_pop(L, 1);
+            throw lua_parser_error(desc, filename);
+        }
+
+        // The chunk is still loaded when it cannot be dumped, only not cached
+        boost::shared_ptr<std::string> dumped(new std::string());
+        if (lua_dump(L, &lua_chunk_cache::writer, dumped.get()) == 0) {
+            store(filename, stamp, dumped);
+        }
+    }
+
+    /**
+     * @brief Removes all chunks held in memory.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+    }
+
+private:
+    typedef std::pair<std::time_t, off_t> file_stamp;
+    typedef boost::shared_ptr<const std::string> bytecode_ptr;
+    typedef std::map<std::string, std::pair<file_stamp, bytecode_ptr> > entry_map;
+
+    // No exception may unwind through lua_dump, which is C code
+    static int writer(lua_State *, const void *p, size_t sz, void *ud)
+    {
+        try {
+            static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+        }
+        catch (const std::bad_alloc &) {
+            return 1;
+        }
+        return 0;
+    }
+
+    bytecode_ptr find(const std::string &filename, const file_stamp &stamp)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entry_map::const_iterator it = entries_.find(filename);
+            if (it != entries_.end() && it->second.first == stamp) {
+                return it->second.second;
+            }
+        }
+
+        if (directory_.empty()) {
+            return bytecode_ptr();
+        }
+
+        std::ifstream stream(persisted_name(filename).c_str(), std::ios_base::binary);
+        std::string header;
+        if (!std::getline(stream, header) || header != persisted_header(filename, stamp)) {
+            return bytecode_ptr();
+        }
+
+        bytecode_ptr bytecode(new std::string((std::istreambuf_iterator<char>(stream)),
+                                              std::istreambuf_iterator<char>()));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_[filename] = std::make_pair(stamp, bytecode);
+
+        return bytecode;
+    }
+
+    void store(const std::string &filename, const file_stamp &stamp, const bytecode_ptr &bytecode)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries_[filename] = std::make_pair(stamp, bytecode);
+        }
+
+        if (directory_.empty()) {
+            return;
+        }
+
+        // Write to a temporary file and rename it, so concurrent readers never
+        // see a partially written chunk. Failing to persist is not an error.
+        const std::string name = persisted_name(filename);
+        std::ostringstream tmpname;
+        tmpname << name << '.' << current_process_id() << '.'
+                << static_cast<const void*>(bytecode.get());
+
+        std::ofstream stream(tmpname.str().c_str(), std::ios_base::binary);
+        stream << persisted_header(filename, stamp) << '\n' << *bytecode;
+        stream.close();
+
+        if (!stream || std::rename(tmpname.str().c_str(), name.c_str()) != 0) {
+            std::remove(tmpname.str().c_str());
+        }
+    }
+
+    // The temporary file names have the process id, as other processes may
+    // persist the same chunk at the same time.
+    static long current_process_id()
+    {
+#if defined(_WIN32)
+        return static_cast<long>(_getpid());
+#else
+        return static_cast<long>(getpid());
+#endif
+    }
+
+    std::string persisted_name(const std::string &filename) const
+    {
+        std::ostringstream name;
+        name << directory_ << '/' << std::hex << boost::hash<std::string>()(filename) << ".luac";
+        return name.str();
+    }
+
+    static std::string persisted_header(const std::string &filename, const file_stamp &stamp)
+    {
+        std::ostringstream header;
+        header << stamp.first << ' ' << stamp.second << ' ' << filename;
+        return header.str();
+    }
+
+    const std::string directory_;
+    entry_map entries_;
+    std::mutex mutex_;
+};
+
+} // namespace lua_parser
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_DETAIL_LUA_CHUNK_CACHE_HPP_ */
@@ -0,0 +1,162 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_DETAIL_LUA_ESCAPE_HPP_
+#define _GOLLD_PROPERTY_TREE_DETAIL_LUA_ESCAPE_HPP_
+
+#include <string>
+
+#if defined(__AVX2__)
+#define _GOLLD_PROPERTY_TREE_LUA_ESCAPE_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define _GOLLD_PROPERTY_TREE_LUA_ESCAPE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace golld {
+namespace property_tree {
+namespace lua_parser {
+
+// Whether c must be escaped inside a single quoted Lua string.
+template<class Ch>
+bool needs_lua_escape(Ch c)
+{
+    return c == Ch('\'') || c == Ch('\\') || (c >= Ch(0) && c < Ch(0x20));
+}
+
+inline bool needs_lua_escape(char c)
+{
+    return c == '\'' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+}
+
+// Appends the escape sequence of c, for which needs_lua_escape is true.
+template<class Ch>
+void append_lua_escape(std::basic_string<Ch> &out, Ch c)
+{
+    out += Ch('\\');
+    switch (c) {
+    case Ch('\''): out += Ch('\''); break;
+    case Ch('\\'): out += Ch('\\'); break;
+    case Ch('\n'): out += Ch('n'); break;
+    case Ch('\r'): out += Ch('r'); break;
+    case Ch('\t'): out += Ch('t'); break;
+    default:
+        {
+            // Always three digits, so a following digit is not taken in
+            const int code = static_cast<unsigned char>(c);
+            out += Ch('0' + code / 100);
+            out += Ch('0' + code / 10 % 10);
+            out += Ch('0' + code % 10);
+        }
+    }
+}
+
+#if defined(_GOLLD_PROPERTY_TREE_LUA_ESCAPE_SSE2) || defined(_GOLLD_PROPERTY_TREE_LUA_ESCAPE_AVX2)
+inline unsigned lowest_bit_index(unsigned mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// Finds the first character needing an escape in [first, last), or last.
+template<class Ch>
+const Ch *find_lua_escape(const Ch *first, const Ch *last)
+{
+    while (first != last && !needs_lua_escape(*first)) {
+        ++first;
+    }
+    return first;
+}
+
+// The char version scans whole blocks with SIMD compares: a byte needs an
+// escape if it equals a quote or a backslash, or if it is not above 0x1f as an
+// unsigned number, that is, if max(byte, 0x1f) == 0x1f.
+inline const char *find_lua_escape(const char *first, const char *last)
+{
+#if defined(_GOLLD_PROPERTY_TREE_LUA_ESCAPE_AVX2)
+    {
+        const __m256i quote = _mm256_set1_epi8('\'');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i control = _mm256_set1_epi8(0x1f);
+        while (last - first >= 32) {
+            const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+            const __m256i special = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(block, quote),
+                                _mm256_cmpeq_epi8(block, backslash)),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(block, control), control));
+            const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+            if (mask != 0) {
+                return first + lowest_bit_index(mask);
+            }
+            first += 32;
+        }
+    }
+#endif
+
+#if defined(_GOLLD_PROPERTY_TREE_LUA_ESCAPE_SSE2)
+    {
+        const __m128i quote = _mm_set1_epi8('\'');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1f);
+        while (last - first >= 16) {
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+            const __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+                _mm_cmpeq_epi8(_mm_max_epu8(block, control), control));
+            const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+            if (mask != 0) {
+                return first + lowest_bit_index(mask);
+            }
+            first += 16;
+        }
+    }
+#endif
+
+    while (first != last && !needs_lua_escape(*first)) {
+        ++first;
+    }
+    return first;
+}
+
+/**
+ * @brief Appends [first, last) to out, escaped to be put between single quotes
+ * in a Lua script.
+ *
+ * The runs of characters without escapes are copied in bulk.
+ */
+template<class Ch>
+void append_lua_escaped(std::basic_string<Ch> &out, const Ch *first, const Ch *last)
+{
+    for (;;) {
+        const Ch *special = find_lua_escape(first, last);
+        out.append(first, special);
+        if (special == last) {
+            return;
+        }
+        append_lua_escape(out, *special);
+        first = special + 1;
+    }
+}
+
+} // namespace lua_parser
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_DETAIL_LUA_ESCAPE_HPP_ */
@@ -0,0 +1,99 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_DETAIL_LUA_MAPPED_FILE_HPP_
+#define _GOLLD_PROPERTY_TREE_DETAIL_LUA_MAPPED_FILE_HPP_
+
+#include <boost/config.hpp>
+#include <boost/noncopyable.hpp>
+#include <cstddef>
+#include <string>
+
+#if defined(BOOST_HAS_UNISTD_H)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace golld {
+namespace property_tree {
+namespace lua_parser {
+
+// A read-only memory mapping of a whole regular file. When the file cannot be
+// mapped (e.g. it is a pipe, or the platform has no mmap), is_mapped() is false
+// and the file must be read by other means.
+class lua_mapped_file
+    : private boost::noncopyable
+{
+public:
+    explicit lua_mapped_file(const std::string &filename)
+        : data_(NULL)
+        , size_(0)
+        , mapped_(false)
+    {
+#if defined(BOOST_HAS_UNISTD_H)
+        const int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            size_ = static_cast<std::size_t>(st.st_size);
+            if (size_ == 0) {
+                data_ = "";
+                mapped_ = true;
+            }
+            else {
+                void *p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    data_ = static_cast<const char*>(p);
+                    mapped_ = true;
+                }
+            }
+        }
+
+        close(fd);
+#endif
+    }
+
+    ~lua_mapped_file()
+    {
+#if defined(BOOST_HAS_UNISTD_H)
+        if (mapped_ && size_ != 0) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    bool is_mapped() const
+    {
+        return mapped_;
+    }
+
+    const char *data() const
+    {
+        return data_;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    const char *data_;
+    std::size_t size_;
+    bool mapped_;
+};
+
+} // namespace lua_parser
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_DETAIL_LUA_MAPPED_FILE_HPP_ */
@@ -0,0 +1,157 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSE_OPTIONS_HPP_
+#define _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSE_OPTIONS_HPP_
+
+#include <cstddef>
+#include <cstdlib>
+
+#include "lua_allocator.hpp"
+
+extern "C"
+{
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+namespace golld {
+namespace property_tree {
+namespace lua_parser {
+
+/// The default maximum nesting of Lua tables translated by read_lua.
+const std::size_t default_max_depth = 512;
+
+/// The Lua standard libraries which can be opened to run a script.
+enum lua_library
+{
+    lua_no_libs = 0,
+    lua_base_lib = 1 << 0,
+    lua_package_lib = 1 << 1,
+    lua_table_lib = 1 << 2,
+    lua_io_lib = 1 << 3,
+    lua_os_lib = 1 << 4,
+    lua_string_lib = 1 << 5,
+    lua_math_lib = 1 << 6,
+    lua_debug_lib = 1 << 7,
+    lua_all_libs = (1 << 8) - 1
+};
+
+/**
+ * @brief Options of the Lua environment where read_lua runs a script.
+ */
+struct lua_parse_options
+{
+    lua_parse_options()
+        : libraries(lua_all_libs)
+        , use_arena(false)
+        , memory_limit(0)
+        , max_depth(default_max_depth)
+    { }
+
+    /// A combination of lua_library flags with the libraries to open.
+    unsigned libraries;
+
+    /**
+     * Whether the Lua memory is taken from an arena, with a bump pointer, and
+     * freed all at once with the Lua state. Memory released by the garbage
+     * collector is not reused, so it is meant for short scripts. Ignored by
+     * lua_state_pool.
+     */
+    bool use_arena;
+
+    /// The maximum memory, in bytes, which the script may use. Zero is unlimited.
+    std::size_t memory_limit;
+
+    /// The maximum nesting of the translated tables.
+    std::size_t max_depth;
+};
+
+// The panic function of the states made by lua_newstate. An error outside a
+// protected call cannot be recovered from, and an exception must not cross
+// the Lua C code, so the process is aborted, without writing to stderr.
+inline int lua_panic(lua_State *)
+{
+    std::abort();
+    return 0;
+}
+
+// Opens the given lua_library flags in L. Returns false on error.
+inline bool open_lua_libs(lua_State *L, unsigned libraries)
+{
+    static const luaL_Reg libs[] = {
+        {"", luaopen_base},
+        {LUA_LOADLIBNAME, luaopen_package},
+        {LUA_TABLIBNAME, luaopen_table},
+        {LUA_IOLIBNAME, luaopen_io},
+        {LUA_OSLIBNAME, luaopen_os},
+        {LUA_STRLIBNAME, luaopen_string},
+        {LUA_MATHLIBNAME, luaopen_math},
+        {LUA_DBLIBNAME, luaopen_debug}
+    };
+
+    for (std::size_t i = 0; i < sizeof(libs) / sizeof(libs[0]); ++i) {
+        if (libraries & (1u << i)) {
+            lua_pushcfunction(L, libs[i].func);
+            lua_pushstring(L, libs[i].name);
+            if (lua_pcall(L, 1, 0, 0)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Closes a state created by open_lua_state.
+inline void close_lua_state(lua_State *L)
+{
+    void *ud;
+    const lua_Alloc f = lua_getallocf(L, &ud);
+
+    lua_close(L);
+
+    if (f == &lua_allocator::alloc) {
+        delete static_cast<lua_allocator*>(ud);
+    }
+}
+
+// Creates a Lua state as asked by options. Returns NULL on error.
+inline lua_State *open_lua_state(const lua_parse_options &options)
+{
+    lua_State *L = NULL;
+
+    if (options.use_arena || options.memory_limit != 0) {
+        lua_allocator *allocator = new lua_allocator(options.use_arena, options.memory_limit);
+        L = lua_newstate(&lua_allocator::alloc, allocator);
+        if (L == NULL) {
+            delete allocator;
+            return NULL;
+        }
+        lua_atpanic(L, &lua_panic);
+    }
+    else {
+        L = luaL_newstate();
+        if (L == NULL) {
+            return NULL;
+        }
+    }
+
+    if (!open_lua_libs(L, options.libraries)) {
+        close_lua_state(L);
+        return NULL;
+    }
+
+    return L;
+}
+
+} // namespace lua_parser
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSE_OPTIONS_HPP_ */
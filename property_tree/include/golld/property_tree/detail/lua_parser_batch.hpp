@@ -0,0 +1,150 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSER_BATCH_HPP_
+#define _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSER_BATCH_HPP_
+
+#include <boost/optional.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <locale>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "lua_parse_options.hpp"
+#include "lua_parser_error.hpp"
+#include "lua_parser_read.hpp"
+#include "lua_state_pool.hpp"
+
+namespace golld {
+namespace property_tree {
+namespace lua_parser {
+
+/**
+ * @brief A Lua file to be read by read_lua_batch.
+ */
+struct lua_read_job
+{
+    lua_read_job()
+    { }
+
+    lua_read_job(const std::string &filename, const std::string &rootKey)
+        : filename(filename)
+        , rootKey(rootKey)
+    { }
+
+    /// The Lua script file name.
+    std::string filename;
+
+    /// The name of the global table to translate.
+    std::string rootKey;
+};
+
+/**
+ * @brief The outcome of a lua_read_job.
+ */
+template<class Ptree>
+struct lua_read_result
+{
+    /// The translated table, when no error happened.
+    Ptree tree;
+
+    /// The error which stopped the read, if any.
+    boost::optional<lua_parser_error> error;
+};
+
+// Reads the jobs taken from next_job until there is none left. The first
+// exception other than lua_parser_error is kept in failure, and stops all
+// the workers.
+template<class Ptree>
+void read_lua_batch_worker(const std::vector<lua_read_job> &jobs,
+                           std::vector<lua_read_result<Ptree> > &results,
+                           const std::locale &loc, lua_state_pool &pool,
+                           std::atomic<std::size_t> &next_job,
+                           std::exception_ptr &failure, std::mutex &failure_mutex)
+{
+    try {
+        // The pool has a state for each worker, so none waits for another
+        for (std::size_t i = next_job++; i < jobs.size(); i = next_job++) {
+            lua_read_result<Ptree> &result = results[i];
+            try {
+                read_lua_internal(jobs[i].filename, jobs[i].rootKey, result.tree, loc, pool);
+            }
+            catch (const lua_parser_error &e) {
+                result.tree.clear();
+                result.error = e;
+            }
+        }
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(failure_mutex);
+        if (!failure) {
+            failure = std::current_exception();
+        }
+        next_job = jobs.size();
+    }
+}
+
+template<class Ptree>
+void read_lua_batch_internal(const std::vector<lua_read_job> &jobs,
+                             std::vector<lua_read_result<Ptree> > &results,
+                             std::size_t threads, const lua_parse_options &options,
+                             const std::locale &loc)
+{
+    results.clear();
+    results.resize(jobs.size());
+    if (jobs.empty()) {
+        return;
+    }
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = std::min(threads, jobs.size());
+
+    lua_state_pool pool(threads, options);
+    std::atomic<std::size_t> next_job(0);
+    std::exception_ptr failure;
+    std::mutex failure_mutex;
+
+    // The calling thread is one of the workers
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (std::size_t i = 1; i < threads; ++i) {
+        try {
+            workers.push_back(std::thread(&read_lua_batch_worker<Ptree>, std::cref(jobs),
+                                          std::ref(results), std::cref(loc), std::ref(pool),
+                                          std::ref(next_job), std::ref(failure),
+                                          std::ref(failure_mutex)));
+        }
+        catch (const std::system_error &) {
+            // Go on with the workers already running
+            break;
+        }
+    }
+    read_lua_batch_worker(jobs, results, loc, pool, next_job, failure, failure_mutex);
+
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+} // namespace lua_parser
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSER_BATCH_HPP_ */
@@ -0,0 +1,235 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSER_PUSH_HPP_
+#define _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSER_PUSH_HPP_
+
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <string>
+#include <typeinfo>
+
+#include "lua_parser_error.hpp"
+#include "number_format.hpp"
+
+extern "C"
+{
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+namespace golld {
+namespace property_tree {
+namespace lua_parser {
+
+// The metamethods of the userdata made by push_ptree. The userdata holds only
+// a pointer to the ptree; its children are pushed when a script asks for them.
+//
+// The Lua errors are raised by longjmp, so no object with a destructor may be
+// alive in the frame calling lua_error. The C++ work is made by functions
+// returning false on failure, and the errors are raised by their callers.
+template<class Ptree>
+struct ptree_proxy
+{
+    typedef typename Ptree::key_type key_type;
+    typedef typename Ptree::const_iterator const_iterator;
+
+    // The position of a __pairs traversal
+    struct cursor
+    {
+        cursor(const_iterator current, const_iterator end)
+            : current(current)
+            , end(end)
+        { }
+
+        const_iterator current;
+        const_iterator end;
+    };
+
+    static const std::string &metatable_name()
+    {
+        static const std::string name =
+            std::string("golld.property_tree.ptree_proxy.") + typeid(Ptree).name();
+        return name;
+    }
+
+    static const std::string &cursor_metatable_name()
+    {
+        static const std::string name =
+            std::string("golld.property_tree.ptree_cursor.") + typeid(Ptree).name();
+        return name;
+    }
+
+    static const Ptree &check(lua_State *L, int index)
+    {
+        return **static_cast<const Ptree**>(
+            luaL_checkudata(L, index, metatable_name().c_str()));
+    }
+
+    static void push(lua_State *L, const Ptree &pt)
+    {
+        const Ptree **ud = static_cast<const Ptree**>(lua_newuserdata(L, sizeof(const Ptree*)));
+        *ud = &pt;
+
+        if (luaL_newmetatable(L, metatable_name().c_str())) {
+            lua_pushcfunction(L, &ptree_proxy::index);
+            lua_setfield(L, -2, "__index");
+            lua_pushcfunction(L, &ptree_proxy::length);
+            lua_setfield(L, -2, "__len");
+            lua_pushcfunction(L, &ptree_proxy::pairs);
+            lua_setfield(L, -2, "__pairs");
+            lua_pushcfunction(L, &ptree_proxy::pairs);
+            lua_setfield(L, -2, "__call");
+        }
+        lua_setmetatable(L, -2);
+    }
+
+    // A leaf is pushed as its data string, any other node as a proxy.
+    static void push_child(lua_State *L, const Ptree &child)
+    {
+        if (child.empty()) {
+            const typename Ptree::data_type &data = child.data();
+            lua_pushlstring(L, data.data(), data.size());
+        }
+        else {
+            push(L, child);
+        }
+    }
+
+    // Finds the child at the key on the top of the stack. Returns false on a
+    // memory error.
+    static bool find(lua_State *L, const Ptree &pt, const Ptree *&child)
+    {
+        child = NULL;
+
+        try {
+            char buffer[detail::number_buffer_size];
+            const char *first = buffer;
+            std::size_t length = 0;
+            double position = 0;
+
+            if (lua_type(L, -1) == LUA_TNUMBER) {
+                position = lua_tonumber(L, -1);
+                length = detail::format_double(position, buffer);
+            }
+            else if (lua_type(L, -1) == LUA_TSTRING) {
+                first = lua_tolstring(L, -1, &length);
+            }
+            else {
+                return true;
+            }
+
+            typename Ptree::const_assoc_iterator it = pt.find(key_type(first, first + length));
+            if (it != pt.not_found()) {
+                child = &it->second;
+                return true;
+            }
+
+            // The children of an array, as made by read_json, have empty keys
+            if (position >= 1 && position <= pt.size() && position == std::floor(position)) {
+                const_iterator nth = pt.begin();
+                std::advance(nth, static_cast<std::size_t>(position) - 1);
+                if (nth->first.empty()) {
+                    child = &nth->second;
+                }
+            }
+        }
+        catch (const std::bad_alloc &) {
+            return false;
+        }
+
+        return true;
+    }
+
+    static int index(lua_State *L)
+    {
+        const Ptree &pt = check(L, 1);
+        lua_settop(L, 2);
+
+        const Ptree *child;
+        if (!find(L, pt, child)) {
+            return luaL_error(L, "not enough memory");
+        }
+
+        if (child == NULL) {
+            lua_pushnil(L);
+        }
+        else {
+            push_child(L, *child);
+        }
+        return 1;
+    }
+
+    static int length(lua_State *L)
+    {
+        lua_pushinteger(L, static_cast<lua_Integer>(check(L, 1).size()));
+        return 1;
+    }
+
+    // Returns the iterator function, with the traversal position as upvalue.
+    static int pairs(lua_State *L)
+    {
+        const Ptree &pt = check(L, 1);
+
+        void *memory = lua_newuserdata(L, sizeof(cursor));
+        new (memory) cursor(pt.begin(), pt.end());
+        if (luaL_newmetatable(L, cursor_metatable_name().c_str())) {
+            lua_pushcfunction(L, &ptree_proxy::collect_cursor);
+            lua_setfield(L, -2, "__gc");
+        }
+        lua_setmetatable(L, -2);
+
+        lua_pushcclosure(L, &ptree_proxy::next, 1);
+        lua_pushvalue(L, 1);
+        lua_pushnil(L);
+        return 3;
+    }
+
+    static int next(lua_State *L)
+    {
+        cursor &position = *static_cast<cursor*>(lua_touserdata(L, lua_upvalueindex(1)));
+        if (position.current == position.end) {
+            lua_pushnil(L);
+            return 1;
+        }
+
+        const key_type &key = position.current->first;
+        lua_pushlstring(L, key.data(), key.size());
+        push_child(L, position.current->second);
+        ++position.current;
+        return 2;
+    }
+
+    static int collect_cursor(lua_State *L)
+    {
+        static_cast<cursor*>(lua_touserdata(L, 1))->~cursor();
+        return 0;
+    }
+};
+
+template<class Ptree>
+void push_ptree_internal(lua_State *L, const Ptree &pt)
+{
+    BOOST_STATIC_ASSERT((boost::is_same<typename Ptree::key_type::value_type, char>::value));
+    BOOST_STATIC_ASSERT((boost::is_same<typename Ptree::data_type::value_type, char>::value));
+
+    if (!lua_checkstack(L, 3)) {
+        throw lua_parser_error("Lua stack overflow", "");
+    }
+
+    ptree_proxy<Ptree>::push(L, pt);
+}
+
+} // namespace lua_parser
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSER_PUSH_HPP_ */
@@ -8,10 +8,25 @@
 #ifndef _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSER_READ_HPP_
 #define _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSER_READ_HPP_
 
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <locale>
+#include <streambuf>
 #include <string>
+#include <vector>
 
+#include "lua_chunk_cache.hpp"
+#include "lua_mapped_file.hpp"
+#include "lua_parse_options.hpp"
 #include "lua_parser_error.hpp"
+#include "lua_state_pool.hpp"
+#include "number_format.hpp"
 
 extern "C"
 {
@@ -24,102 +39,589 @@ namespace golld {
 namespace property_tree {
 namespace lua_parser {
 
-void read_data(lua_State *L, boost::property_tree::ptree &pt)
+// Puts in pt the data of the non-table value on the top of the stack.
+template<class Ptree>
+void read_value(lua_State *L, Ptree &pt)
 {
-    lua_pushnil(L);
-    while (lua_next(L, -2) != 0) {
-        int key_type = lua_type(L, -2);
-        int value_type = lua_type(L, -1);
+    switch (lua_type(L, -1)) {
+    case LUA_TSTRING:
+        {
+            size_t length;
+            const char *value = lua_tolstring(L, -1, &length);
+            pt.data().assign(value, value + length);
+            break;
+        }
+    case LUA_TNUMBER:
+        {
+            char buffer[detail::number_buffer_size];
+            const std::size_t length = detail::format_double(lua_tonumber(L, -1), buffer);
+            pt.data().assign(buffer, buffer + length);
+            break;
+        }
+    case LUA_TBOOLEAN:
+        {
+            static const char true_string[] = "true";
+            static const char false_string[] = "false";
+            if (lua_toboolean(L, -1)) {
+                pt.data().assign(true_string, true_string + 4);
+            }
+            else {
+                pt.data().assign(false_string, false_string + 5);
+            }
+            break;
+        }
+    default:
+        throw lua_parser_error("The value type must be number or boolean or table or string", "");
+    }
+}
 
-        if (key_type != LUA_TSTRING && key_type != LUA_TNUMBER) {
-            lua_pop(L, 1);
-            throw lua_parser_error("Support only string or number keys", "");
+// A table being translated by a lua_table_reader.
+template<class Ptree>
+struct read_frame
+{
+    read_frame(Ptree *node, int length)
+        : node(node)
+        , length(length)
+        , index(0)
+    { }
+
+    // The ptree receiving the table children
+    Ptree *node;
+
+    // The length of the table sequence part
+    int length;
+
+    // The last sequence index read, or length + 1 while walking the other keys
+    int index;
+};
+
+/**
+ * @brief Translates a Lua table to a ptree in several steps.
+ *
+ * The conversion of a large table can be spread over many calls to step, each
+ * one translating a bounded number of table entries or running for a bounded
+ * time. Between the calls, the tables being walked are kept on the Lua stack,
+ * above the one being translated, so the stack must not be changed until the
+ * conversion is done. The partially built tree can be read meanwhile.
+ *
+ * If the reader is destroyed, or step throws, before the conversion is done,
+ * the stack is restored to what it was at construction.
+ */
+template<class Ptree>
+class lua_table_reader
+    : private boost::noncopyable
+{
+public:
+    /**
+     * @brief Prepares the conversion of the table on the top of the stack.
+     *
+     * @param L The Lua state. It must outlive the reader.
+     * @param pt The ptree receiving the table children. It must outlive the
+     * reader, and its existing children are kept.
+     * @param max_depth The maximum nesting of the translated tables. Deeper
+     * tables, including cyclic ones, make step throw a lua_parser_error.
+     *
+     * A value on the top of the stack which is not a table raises a
+     * lua_parser_error.
+     */
+    lua_table_reader(lua_State *L, Ptree &pt, std::size_t max_depth = default_max_depth)
+        : L_(L)
+        , max_depth_(max_depth)
+        , top_(lua_gettop(L))
+        , nodes_(0)
+    {
+        if (lua_type(L, -1) != LUA_TTABLE) {
+            throw lua_parser_error("The value is not a table", "");
+        }
+        if (!lua_checkstack(L, 4)) {
+            throw lua_parser_error("Lua stack overflow", "");
         }
-        lua_pushvalue(L, -2);
-        std::string key_string(lua_tostring(L, -1));
-        lua_pop(L, 1);
 
-        boost::property_tree::ptree tmp;
-        switch (value_type) {
-        case LUA_TTABLE:
-            read_data(L, tmp);
-            break;
-        case LUA_TSTRING:
-            {
-                std::string value(lua_tostring(L, -1));
-                tmp.put_value(value);
-                break;
+        // Each frame pops its table when done, the caller's one included
+        lua_pushvalue(L, -1);
+        stack_.push_back(read_frame<Ptree>(&pt, static_cast<int>(lua_objlen(L, -1))));
+    }
+
+    ~lua_table_reader()
+    {
+        if (!done()) {
+            lua_settop(L_, top_);
+        }
+    }
+
+    /**
+     * @brief Takes at most max_nodes steps of the walk over the table.
+     *
+     * A step translates a table entry, or skips an entry which is not
+     * translated, as a hole in the sequence part, or ends a nested table. So
+     * at most max_nodes entries are translated, and a table with few
+     * translated entries cannot make one call run long.
+     *
+     * @return Whether the conversion is done.
+     */
+    bool step(std::size_t max_nodes)
+    {
+        return walk(max_nodes, NULL);
+    }
+
+    /**
+     * @brief Takes at most max_nodes steps of the walk, as step(max_nodes),
+     * stopping earlier when max_time has elapsed.
+     *
+     * The clock is read once every few steps, so the time limit can be
+     * slightly exceeded.
+     *
+     * @return Whether the conversion is done.
+     */
+    bool step(std::size_t max_nodes, std::chrono::microseconds max_time)
+    {
+        const std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + max_time;
+        return walk(max_nodes, &deadline);
+    }
+
+    /**
+     * @brief Whether the whole table was translated.
+     */
+    bool done() const
+    {
+        return stack_.empty();
+    }
+
+    /**
+     * @brief The number of table entries translated so far.
+     */
+    std::size_t nodes() const
+    {
+        return nodes_;
+    }
+
+private:
+    // The number of steps between two clock readings
+    static const std::size_t clock_interval = 64;
+
+    bool walk(std::size_t max_steps, const std::chrono::steady_clock::time_point *deadline)
+    {
+        try {
+            // Every step counts, translated or not, so the limits always hold
+            for (std::size_t count = 0; !stack_.empty() && count < max_steps; ++count) {
+                if (deadline != NULL && count % clock_interval == clock_interval - 1 &&
+                    std::chrono::steady_clock::now() >= *deadline) {
+                    break;
+                }
+                next();
             }
-        case LUA_TNUMBER:
-            {
-                lua_Number value = lua_tonumber(L, -1);
-                tmp.put_value(value);
-                break;
+        }
+        catch (...) {
+            stack_.clear();
+            lua_settop(L_, top_);
+            throw;
+        }
+
+        return done();
+    }
+
+    // Advances the walk by one step. Returns whether an entry was translated.
+    bool next()
+    {
+        lua_State *L = L_;
+        read_frame<Ptree> &frame = stack_.back();
+
+        if (frame.index < frame.length) {
+            // The sequence part is read first, in index order
+            ++frame.index;
+            lua_rawgeti(L, -1, frame.index);
+            if (lua_isnil(L, -1)) {
+                lua_pop(L, 1);
+                return false;
             }
-        case LUA_TBOOLEAN:
-            {
-                bool value = lua_toboolean(L, -1);
-                tmp.put_value(value);
-                break;
+            key_.assign(buffer_, buffer_ + detail::format_integer(frame.index, buffer_));
+        }
+        else {
+            if (frame.index == frame.length) {
+                ++frame.index;
+                lua_pushnil(L);
             }
-        default:
+            if (lua_next(L, -2) == 0) {
+                lua_pop(L, 1);
+                stack_.pop_back();
+                return false;
+            }
+
+            int key_type = lua_type(L, -2);
+            if (key_type != LUA_TSTRING && key_type != LUA_TNUMBER) {
+                throw lua_parser_error("Support only string or number keys", "");
+            }
+
+            if (key_type == LUA_TNUMBER) {
+                const lua_Number key = lua_tonumber(L, -2);
+                if (key >= 1 && key <= frame.length && key == static_cast<int>(key)) {
+                    lua_pop(L, 1);
+                    return false;
+                }
+                key_.assign(buffer_, buffer_ + detail::format_double(key, buffer_));
+            }
+            else {
+                // A string key is not modified by lua_tolstring, so it is safe
+                // for lua_next
+                size_t length;
+                const char *key = lua_tolstring(L, -2, &length);
+                key_.assign(key, key + length);
+            }
+        }
+
+        Ptree &child = frame.node->push_back(std::make_pair(key_, Ptree()))->second;
+        ++nodes_;
+
+        if (lua_type(L, -1) == LUA_TTABLE) {
+            if (stack_.size() >= max_depth_) {
+                throw lua_parser_error("Maximum table depth exceeded", "");
+            }
+            if (!lua_checkstack(L, 3)) {
+                throw lua_parser_error("Lua stack overflow", "");
+            }
+            stack_.push_back(read_frame<Ptree>(&child, static_cast<int>(lua_objlen(L, -1))));
+        }
+        else {
+            read_value(L, child);
             lua_pop(L, 1);
-            throw lua_parser_error("The value type must be number or boolean or table or string", "");
         }
 
-        pt.push_back(std::make_pair(key_string, tmp));
-        lua_pop(L, 1);
+        return true;
     }
+
+    lua_State *const L_;
+    const std::size_t max_depth_;
+    const int top_;
+    std::size_t nodes_;
+    std::vector<read_frame<Ptree> > stack_;
+    typename Ptree::key_type key_;
+    char buffer_[detail::number_buffer_size];
+};
+
+// Translates the table on the top of the stack to pt children.
+//
+// The tables are walked with an explicit stack, and each child is built in its
+// final place in pt. Tables nested deeper than max_depth (including cyclic
+// ones) raise a lua_parser_error.
+template<class Ptree>
+void read_data(lua_State *L, Ptree &pt, std::size_t max_depth = default_max_depth)
+{
+    lua_table_reader<Ptree> reader(L, pt, max_depth);
+    reader.step(std::numeric_limits<std::size_t>::max());
 }
 
+// Translates the table at index of the stack to pt, leaving the stack as it was.
 template<class Ptree>
-void read_lua_internal(std::basic_istream<typename Ptree::key_type::value_type> &stream,
-                       const std::string &rootKey, Ptree &pt, const std::string &filename)
+void read_lua_table_internal(lua_State *L, int index, Ptree &pt, std::size_t max_depth)
 {
-    typedef typename Ptree::key_type::value_type Ch;
-    typedef typename std::basic_string<Ch> Str;
+    if (lua_type(L, index) != LUA_TTABLE) {
+        throw lua_parser_error("The value is not a table", "");
+    }
 
     pt.clear();
 
-    std::basic_string<Ch> s(std::istreambuf_iterator<Ch>(stream.rdbuf()),
-                            std::istreambuf_iterator<Ch>());
-    if (!stream.good()) {
-        throw lua_parser_error("read error", filename);
-    }
-
-    lua_State *L = NULL;
+    const int top = lua_gettop(L);
+    lua_pushvalue(L, index);
 
-    L = luaL_newstate();
-    if (L == NULL) {
-        throw lua_parser_error("Error on creating Lua environment", filename);
+    try {
+        read_data(L, pt, max_depth);
+    }
+    catch (...) {
+        lua_settop(L, top);
+        throw;
     }
 
-    luaL_openlibs(L);
+    lua_settop(L, top);
+}
 
-    if (luaL_dostring(L, s.c_str())) {
+// Runs the Lua chunk on the top of the stack. The values it returns are
+// dropped, so the stack is left as it was below the chunk.
+inline void run_lua_chunk(lua_State *L, const std::string &filename)
+{
+    lua_allocator::limit_scope limit(L);
+    if (lua_pcall(L, 0, 0, 0)) {
         std::string desc(lua_tostring(L, -1));
-        lua_close(L);
+        lua_pop(L, 1);
         throw lua_parser_error(desc, filename);
     }
+}
 
+// Translates the rootKey global table to pt. A global which is not a table
+// raises a lua_parser_error.
+template<class Ptree>
+void read_lua_root(lua_State *L, const std::string &rootKey, Ptree &pt,
+                   const std::string &filename, std::size_t max_depth,
+                   const std::string &not_found)
+{
     lua_getglobal(L, rootKey.c_str());
     if (lua_isnil(L, -1)) {
-        lua_close(L);
-        throw lua_parser_error("Root key not found", filename);
+        lua_pop(L, 1);
+        throw lua_parser_error(not_found, filename);
+    }
+    if (lua_type(L, -1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        throw lua_parser_error("Root key is not a table: " + rootKey, filename);
     }
 
-    pt.put_value(rootKey);
+    pt.data().assign(rootKey.begin(), rootKey.end());
 
     try {
-        read_data(L, pt);
+        read_data(L, pt, max_depth);
     }
     catch (const lua_parser_error &e) {
-        lua_close(L);
         throw lua_parser_error(e.message(), filename);
     }
 
     lua_pop(L, 1);
-    lua_close(L);
+}
+
+// Runs the Lua chunk on the top of the stack and translates its rootKey table to pt.
+template<class Ptree>
+void read_lua_chunk(lua_State *L, const std::string &rootKey, Ptree &pt,
+                    const std::string &filename, std::size_t max_depth)
+{
+    run_lua_chunk(L, filename);
+    read_lua_root(L, rootKey, pt, filename, max_depth, "Root key not found");
+}
+
+// Runs the Lua chunk on the top of the stack and translates each of the
+// rootKeys tables to a child of pt. When rootKeys is empty, all the table
+// globals created or replaced by the chunk are translated, sorted by name.
+template<class Ptree>
+void read_lua_chunk(lua_State *L, const std::vector<std::string> &rootKeys, Ptree &pt,
+                    const std::string &filename, std::size_t max_depth)
+{
+    std::vector<std::string> keys(rootKeys);
+
+    if (keys.empty()) {
+        // A shallow copy of the globals before the chunk runs
+        lua_newtable(L);
+        lua_pushnil(L);
+        while (lua_next(L, LUA_GLOBALSINDEX) != 0) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, -4);
+        }
+        lua_insert(L, -2);
+        const int snapshot = lua_gettop(L) - 1;
+
+        run_lua_chunk(L, filename);
+
+        lua_pushnil(L);
+        while (lua_next(L, LUA_GLOBALSINDEX) != 0) {
+            if (lua_type(L, -2) == LUA_TSTRING && lua_type(L, -1) == LUA_TTABLE) {
+                lua_pushvalue(L, -2);
+                lua_rawget(L, snapshot);
+                if (!lua_rawequal(L, -1, -2)) {
+                    keys.push_back(lua_tostring(L, -3));
+                }
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+
+        std::sort(keys.begin(), keys.end());
+    }
+    else {
+        run_lua_chunk(L, filename);
+    }
+
+    std::vector<std::string>::const_iterator it = keys.begin();
+    for (; it != keys.end(); ++it) {
+        const typename Ptree::key_type key(it->begin(), it->end());
+        Ptree &child = pt.push_back(std::make_pair(key, Ptree()))->second;
+        read_lua_root(L, *it, child, filename, max_depth, "Root key not found: " + *it);
+    }
+}
+
+// A lua_Reader which feeds the Lua compiler with fixed-size blocks taken
+// straight from a stream buffer.
+template<class Ch>
+class lua_stream_reader
+{
+public:
+    explicit lua_stream_reader(std::basic_streambuf<Ch> *buf)
+        : buf_(buf)
+        , failed_(false)
+    { }
+
+    static const char *read(lua_State *, void *ud, size_t *size)
+    {
+        lua_stream_reader *self = static_cast<lua_stream_reader*>(ud);
+
+        // An exception must not cross the Lua C code
+        std::streamsize n = 0;
+        try {
+            n = self->buf_->sgetn(self->block_, block_size);
+        }
+        catch (...) {
+            self->failed_ = true;
+        }
+
+        *size = n > 0 ? static_cast<size_t>(n) : 0;
+        return self->block_;
+    }
+
+    bool failed() const
+    {
+        return failed_;
+    }
+
+private:
+    static const std::streamsize block_size = 16384;
+
+    std::basic_streambuf<Ch> *buf_;
+    bool failed_;
+    Ch block_[block_size];
+};
+
+// Pushes onto the stack the Lua chunk compiled from the script read from stream.
+template<class Ch>
+void load_lua_stream(lua_State *L, std::basic_istream<Ch> &stream, const std::string &filename)
+{
+    if (!stream.good()) {
+        throw lua_parser_error("read error", filename);
+    }
+
+    const std::string chunkname = filename.empty() ? "=stream" : "@" + filename;
+    lua_stream_reader<Ch> reader(stream.rdbuf());
+
+    const int status = lua_load(L, &lua_stream_reader<Ch>::read, &reader, chunkname.c_str());
+    if (reader.failed()) {
+        lua_pop(L, 1);
+        throw lua_parser_error("read error", filename);
+    }
+    if (status) {
+        std::string desc(lua_tostring(L, -1));
+        lua_pop(L, 1);
+        throw lua_parser_error(desc, filename);
+    }
+}
+
+// Pushes onto the stack the Lua chunk compiled from the script of a file.
+// Regular files are mapped in memory and compiled in place.
+template<class Ch>
+void load_lua_file(lua_State *L, const std::string &filename, const std::locale &loc)
+{
+    lua_mapped_file file(filename);
+    if (!file.is_mapped()) {
+        std::basic_ifstream<Ch> stream(filename.c_str());
+        if (!stream) {
+            throw lua_parser_error("cannot open file", filename);
+        }
+        stream.imbue(loc);
+
+        load_lua_stream(L, stream, filename);
+        return;
+    }
+
+    const std::string chunkname = "@" + filename;
+    if (luaL_loadbuffer(L, file.data(), file.size(), chunkname.c_str())) {
+        std::string desc(lua_tostring(L, -1));
+        lua_pop(L, 1);
+        throw lua_parser_error(desc, filename);
+    }
+}
+
+// A new Lua state created as asked by options, closed on destruction.
+class scoped_lua_state
+    : private boost::noncopyable
+{
+public:
+    scoped_lua_state(const std::string &filename, const lua_parse_options &options)
+        : L_(open_lua_state(options))
+    {
+        if (L_ == NULL) {
+            throw lua_parser_error("Error on creating Lua environment", filename);
+        }
+    }
+
+    ~scoped_lua_state()
+    {
+        close_lua_state(L_);
+    }
+
+    lua_State *get() const
+    {
+        return L_;
+    }
+
+private:
+    lua_State *L_;
+};
+
+// The Roots parameter of the read_lua_internal functions is either a single
+// root key or a vector of them (see read_lua_chunk).
+
+template<class Ptree, class Roots>
+void read_lua_internal(std::basic_istream<typename Ptree::key_type::value_type> &stream,
+                       const Roots &roots, Ptree &pt, const std::string &filename,
+                       const lua_parse_options &options)
+{
+    pt.clear();
+
+    scoped_lua_state state(filename, options);
+    load_lua_stream(state.get(), stream, filename);
+    read_lua_chunk(state.get(), roots, pt, filename, options.max_depth);
+}
+
+template<class Ptree>
+void read_lua_internal(std::basic_istream<typename Ptree::key_type::value_type> &stream,
+                       const std::string &rootKey, Ptree &pt, const std::string &filename,
+                       lua_state_pool &pool)
+{
+    pt.clear();
+
+    lua_state_pool::scoped_state state(pool);
+    load_lua_stream(state.get(), stream, filename);
+    read_lua_chunk(state.get(), rootKey, pt, filename, pool.options().max_depth);
+}
+
+template<class Ptree, class Roots>
+void read_lua_internal(const std::string &filename, const Roots &roots, Ptree &pt,
+                       const std::locale &loc, const lua_parse_options &options)
+{
+    pt.clear();
+
+    scoped_lua_state state(filename, options);
+    load_lua_file<typename Ptree::key_type::value_type>(state.get(), filename, loc);
+    read_lua_chunk(state.get(), roots, pt, filename, options.max_depth);
+}
+
+template<class Ptree>
+void read_lua_internal(const std::string &filename, const std::string &rootKey, Ptree &pt,
+                       const std::locale &loc, lua_state_pool &pool)
+{
+    pt.clear();
+
+    lua_state_pool::scoped_state state(pool);
+    load_lua_file<typename Ptree::key_type::value_type>(state.get(), filename, loc);
+    read_lua_chunk(state.get(), rootKey, pt, filename, pool.options().max_depth);
+}
+
+template<class Ptree>
+void read_lua_internal(const std::string &filename, const std::string &rootKey, Ptree &pt,
+                       lua_chunk_cache &cache)
+{
+    pt.clear();
+
+    const lua_parse_options options;
+    scoped_lua_state state(filename, options);
+    cache.load(state.get(), filename);
+    read_lua_chunk(state.get(), rootKey, pt, filename, options.max_depth);
+}
+
+template<class Ptree>
+void read_lua_internal(const std::string &filename, const std::string &rootKey, Ptree &pt,
+                       lua_chunk_cache &cache, lua_state_pool &pool)
+{
+    pt.clear();
+
+    lua_state_pool::scoped_state state(pool);
+    cache.load(state.get(), filename);
+    read_lua_chunk(state.get(), rootKey, pt, filename, pool.options().max_depth);
 }
 
 } // namespace lua_parser
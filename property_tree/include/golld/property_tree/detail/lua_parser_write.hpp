@@ -13,82 +13,531 @@
 #ifndef _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSER_WRITE_HPP_
 #define _GOLLD_PROPERTY_TREE_DETAIL_LUA_PARSER_WRITE_HPP_
 
+#include <cstddef>
+#include <new>
+#include <ostream>
 #include <string>
+#include <utility>
+#include <vector>
+#include <boost/next_prior.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "lua_escape.hpp"
+#include "lua_parse_options.hpp"
+#include "lua_parser_error.hpp"
+
+extern "C"
+{
+#include <lua.h>
+#include <lauxlib.h>
+}
 
 namespace golld {
 namespace property_tree {
 namespace lua_parser {
 
+// The text written by lua_writer for the subtrees of the last written tree.
+//
+// A subtree is known by the address of its node, which stays the same while
+// the node is in the tree. The caller reports each change with mark_dirty:
+// the marked node is written again with all its subtree, and its ancestors
+// are written again around the cached text of their other children. The
+// text of an unmarked subtree is copied without reading the subtree.
+//
+// A node is only inserted or erased by changing its parent, which must then
+// be marked, so a node made at the address of an erased one is never looked
+// up. Each entry lists the cached subtrees directly inside it, which are
+// forgotten with it when it is marked, so the cache holds only entries of
+// the nodes in the tree.
 template<class Ptree>
-void write_lua_helper(std::basic_ostream<typename Ptree::key_type::value_type> &stream,
-                      const Ptree &pt, int indent)
+class lua_write_cache
+    : private boost::noncopyable
 {
+public:
     typedef typename Ptree::key_type::value_type Ch;
     typedef typename std::basic_string<Ch> Str;
 
-    if (indent == 0) {
-        stream << pt.template get_value<Str>() << Ch('=');
-    }
+    // Whether a node is unchanged, is an ancestor of a marked node, or is
+    // under a marked node.
+    enum state { clean, changed, replaced };
 
-    if (pt.empty()) {
-        stream << Ch('\'') << pt.template get_value<Str>() << Ch('\'');
+    struct entry
+    {
+        Str text;
+        std::size_t nodes;
+        std::vector<const Ptree*> children;
+    };
+
+    explicit lua_write_cache(std::size_t min_nodes)
+        : min_nodes_(min_nodes)
+        , root_(NULL)
+    { }
+
+    // Starts a write of pt. Another tree than the last written is written
+    // from scratch.
+    void prepare(const Ptree &pt)
+    {
+        if (&pt != root_) {
+            clear();
+            root_ = &pt;
+        }
     }
-    else {
-        stream << Ch('{') << Ch('\n');
-        typename Ptree::const_iterator it = pt.begin();
-        for (; it != pt.end(); ++it) {
-            stream << Str(4 * (indent + 1), Ch(' '));
-            if (!it->first.empty()) {
-                stream << Str("['") << it->first << Str("'] = ");
+
+    // Marks the node at path, in the last written tree, as changed. A path
+    // not found marks the deepest node found, whose children changed.
+    void mark_dirty(const typename Ptree::path_type &path)
+    {
+        if (root_ == NULL) {
+            return;
+        }
+
+        typename Ptree::path_type rest(path);
+        const Ptree *node = root_;
+        while (!rest.empty()) {
+            typename Ptree::const_assoc_iterator it = node->find(rest.reduce());
+            if (it == node->not_found()) {
+                break;
             }
-            write_lua_helper(stream, it->second, indent + 1);
-            stream << Ch(',');
-            stream << Ch('\n');
+            dirty_.insert(std::make_pair(node, false));
+            node = &it->second;
+        }
+
+        if (node == root_) {
+            clear();
+        }
+        else {
+            dirty_[node] = true;
         }
-        stream << Str(4 * indent, Ch(' '));
-        stream << Ch('}');
     }
-}
 
-// Verify if ptree does not contain information that cannot be written to a Lua table
+    state node_state(const Ptree &pt) const
+    {
+        if (dirty_.empty()) {
+            return clean;
+        }
+
+        typename dirty_map::const_iterator it = dirty_.find(&pt);
+        if (it == dirty_.end()) {
+            return clean;
+        }
+        return it->second ? replaced : changed;
+    }
+
+    // The cached text of the subtree pt, or NULL.
+    const entry *find(const Ptree &pt) const
+    {
+        typename entry_map::const_iterator it = entries_.find(&pt);
+        return it == entries_.end() ? NULL : &it->second;
+    }
+
+    // Keeps the text of pt, if it is large enough, with the cached subtrees
+    // in it. Returns whether it was kept.
+    template<class Iterator>
+    bool store(const Ptree &pt, std::size_t nodes, const Ch *first, const Ch *last,
+               Iterator first_child, Iterator last_child)
+    {
+        if (nodes < min_nodes_) {
+            forget(pt);
+            return false;
+        }
+
+        entry &stored = entries_[&pt];
+        stored.text.assign(first, last);
+        stored.nodes = nodes;
+        stored.children.assign(first_child, last_child);
+        return true;
+    }
+
+    // Drops the text of pt and of the subtrees cached in it.
+    void forget(const Ptree &pt)
+    {
+        typename entry_map::iterator it = entries_.find(&pt);
+        if (it == entries_.end()) {
+            return;
+        }
+
+        std::vector<const Ptree*> children;
+        children.swap(it->second.children);
+        entries_.erase(it);
+        for (std::size_t i = 0; i < children.size(); ++i) {
+            forget(*children[i]);
+        }
+    }
+
+    // Ends a successful write.
+    void commit()
+    {
+        dirty_.clear();
+    }
+
+    // Ends a failed write. Which entries it changed is not known, so all
+    // are dropped.
+    void abandon()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        entries_.clear();
+        dirty_.clear();
+        root_ = NULL;
+    }
+
+private:
+    typedef boost::unordered_map<const Ptree*, entry> entry_map;
+    typedef boost::unordered_map<const Ptree*, bool> dirty_map;
+
+    const std::size_t min_nodes_;
+    const Ptree *root_;
+    entry_map entries_;
+    dirty_map dirty_;
+};
+
+// Writes a ptree as Lua source to a single growing buffer.
+//
+// The indentation of every level is a prefix of one string of spaces, and
+// keys and values are appended directly, so writing a node allocates nothing
+// besides the buffer growth. Keys and values are escaped, and the table name
+// is written as it is. In compact mode no whitespace is written.
+//
+// The tree is checked while it is written: the root must have data, naming
+// the table, and no other node can have both data and children.
+//
+// With a cache, the unchanged subtrees written before are copied from it.
+// Its prepare must have been called with the same tree.
 template<class Ptree>
-bool verify_lua(const Ptree &pt, int depth)
+class lua_writer
 {
+public:
     typedef typename Ptree::key_type::value_type Ch;
     typedef typename std::basic_string<Ch> Str;
 
-    // Root ptree must have data
-    if (depth == 0 && pt.template get_value<Str>().empty())
-        return false;
+    explicit lua_writer(bool pretty, lua_write_cache<Ptree> *cache = NULL)
+        : pretty_(pretty)
+        , cache_(cache)
+        , nodes_(0)
+    { }
 
-    // Ptree cannot have both children and data
-    if (!pt.template get_value<Str>().empty() && !pt.empty() && depth != 0)
-        return false;
+    // Returns false if the tree cannot be represented as a Lua table. The
+    // buffer contents are then unspecified.
+    bool write(const Ptree &pt)
+    {
+        if (pt.data().empty()) {
+            return false;
+        }
 
-    // Check children
-    typename Ptree::const_iterator it = pt.begin();
-    for (; it != pt.end(); ++it)
-        if (!verify_lua(it->second, depth + 1))
+        // The root is not cached: its text would be the whole output
+        append(pt.data());
+        out_ += Ch('=');
+        if (!write_children(pt, 0, false)) {
             return false;
+        }
+        out_ += Ch('\n');
 
-    // Success
-    return true;
-}
+        return true;
+    }
+
+    const Str &str() const
+    {
+        return out_;
+    }
+
+    void reserve(std::size_t size)
+    {
+        out_.reserve(size);
+    }
+
+private:
+    typedef lua_write_cache<Ptree> cache_type;
+
+    static const std::size_t indent_width = 4;
+
+    bool write_node(const Ptree &pt, std::size_t indent, bool replaced)
+    {
+        ++nodes_;
+        if (cache_ == NULL) {
+            return write_children(pt, indent, false);
+        }
+
+        const typename cache_type::state state =
+            replaced ? cache_type::replaced : cache_->node_state(pt);
+        if (state == cache_type::replaced) {
+            cache_->forget(pt);
+        }
+
+        // A leaf is written faster than it is looked up
+        if (pt.empty()) {
+            return write_children(pt, indent, false);
+        }
+
+        if (state == cache_type::clean) {
+            const typename cache_type::entry *cached = cache_->find(pt);
+            if (cached != NULL) {
+                append(cached->text);
+                nodes_ += cached->nodes - 1;
+                cached_.push_back(&pt);
+                return true;
+            }
+        }
+
+        const std::size_t first_node = nodes_ - 1;
+        const std::size_t first_cached = cached_.size();
+        const std::size_t start = out_.size();
+        if (!write_children(pt, indent, state == cache_type::replaced)) {
+            return false;
+        }
+
+        const bool stored = cache_->store(pt, nodes_ - first_node,
+                                          out_.data() + start, out_.data() + out_.size(),
+                                          cached_.begin() + first_cached, cached_.end());
+        cached_.resize(first_cached);
+        if (stored) {
+            cached_.push_back(&pt);
+        }
+        return true;
+    }
+
+    bool write_children(const Ptree &pt, std::size_t indent, bool replaced)
+    {
+        if (pt.empty()) {
+            out_ += Ch('\'');
+            append_escaped(pt.data());
+            out_ += Ch('\'');
+            return true;
+        }
+
+        if (indent != 0 && !pt.data().empty()) {
+            return false;
+        }
+
+        out_ += Ch('{');
+        if (pretty_) {
+            out_ += Ch('\n');
+        }
+
+        typename Ptree::const_iterator it = pt.begin();
+        for (; it != pt.end(); ++it) {
+            if (pretty_) {
+                write_indent(indent + 1);
+            }
+            if (!it->first.empty()) {
+                out_ += Ch('[');
+                out_ += Ch('\'');
+                append_escaped(it->first);
+                out_ += Ch('\'');
+                out_ += Ch(']');
+                if (pretty_) {
+                    out_ += Ch(' ');
+                    out_ += Ch('=');
+                    out_ += Ch(' ');
+                }
+                else {
+                    out_ += Ch('=');
+                }
+            }
+            if (!write_node(it->second, indent + 1, replaced)) {
+                return false;
+            }
+            if (pretty_) {
+                out_ += Ch(',');
+                out_ += Ch('\n');
+            }
+            else if (boost::next(it) != pt.end()) {
+                out_ += Ch(',');
+            }
+        }
+
+        if (pretty_) {
+            write_indent(indent);
+        }
+        out_ += Ch('}');
+
+        return true;
+    }
+
+    void write_indent(std::size_t indent)
+    {
+        const std::size_t size = indent_width * indent;
+        if (spaces_.size() < size) {
+            spaces_.resize(2 * size, Ch(' '));
+        }
+        out_.append(spaces_.data(), size);
+    }
+
+    // Keys and data may be strings with other allocators than Str
+    template<class String>
+    void append(const String &str)
+    {
+        out_.append(str.data(), str.size());
+    }
+
+    template<class String>
+    void append_escaped(const String &str)
+    {
+        append_lua_escaped(out_, str.data(), str.data() + str.size());
+    }
+
+    const bool pretty_;
+    cache_type *const cache_;
+    std::size_t nodes_;
+    // The cached subtrees written or copied under the nodes being written
+    std::vector<const Ptree*> cached_;
+    Str out_;
+    Str spaces_;
+};
 
 template<class Ptree>
 void write_lua_internal(std::basic_ostream<typename Ptree::key_type::value_type> &stream,
-                        const Ptree &pt, const std::string &filename)
+                        const Ptree &pt, const std::string &filename, bool pretty)
 {
-    if (!verify_lua(pt, 0)) {
+    // Nothing is written unless the whole tree is valid
+    lua_writer<Ptree> writer(pretty);
+    if (!writer.write(pt)) {
         throw lua_parser_error("ptree contains data that cannot be represented in a Lua table", filename);
     }
 
-    write_lua_helper(stream, pt, 0);
+    stream.write(writer.str().data(), writer.str().size());
+    stream.flush();
+}
 
-    stream << std::endl;
+// The lua_Writer appending a dumped chunk to a string.
+inline int append_lua_chunk(lua_State *, const void *p, size_t size, void *ud)
+{
+    try {
+        static_cast<std::string*>(ud)->append(static_cast<const char*>(p), size);
+    }
+    catch (const std::bad_alloc &) {
+        return 1;
+    }
+    return 0;
 }
 
+template<class Ptree>
+void write_lua_bytecode_internal(std::ostream &stream, const Ptree &pt,
+                                 const std::string &filename)
+{
+    lua_writer<Ptree> writer(false);
+    if (!writer.write(pt)) {
+        throw lua_parser_error("ptree contains data that cannot be represented in a Lua table", filename);
+    }
+
+    // Compiling needs no library
+    lua_parse_options options;
+    options.libraries = lua_no_libs;
+    lua_State *L = open_lua_state(options);
+    if (L == NULL) {
+        throw lua_parser_error("Error on creating Lua environment", filename);
+    }
+
+    std::string bytecode;
+    std::string error;
+    const std::string chunkname = filename.empty() ? std::string("=stream") : "@" + filename;
+    if (luaL_loadbuffer(L, writer.str().data(), writer.str().size(), chunkname.c_str()) != 0) {
+        error = lua_tostring(L, -1);
+    }
+    else if (lua_dump(L, &append_lua_chunk, &bytecode) != 0) {
+        error = "Error on dumping the Lua chunk";
+    }
+    close_lua_state(L);
+
+    if (!error.empty()) {
+        throw lua_parser_error(error, filename);
+    }
+
+    stream.write(bytecode.data(), bytecode.size());
+    stream.flush();
+}
+
+/**
+ * @brief Writes the same ptree many times, after small changes.
+ *
+ * The text of each large subtree is kept between the writes. The caller
+ * reports the changes made since the last write with mark_dirty, and the
+ * next write formats only the marked subtrees and their ancestors: the text
+ * of the other subtrees is copied without reading them. A write is thus
+ * faster than write_lua when few nodes changed.
+ *
+ * The output is that of write_lua as long as every change is marked. A
+ * change left unmarked may be missed; after changes too many to tell, call
+ * clear. Writing another ptree object starts from scratch.
+ *
+ * @code
+ * serializer.write(stream, pt);
+ * pt.put("server.port", 8081);
+ * serializer.mark_dirty("server.port");
+ * serializer.write(stream, pt);
+ * @endcode
+ */
+template<class Ptree>
+class lua_serializer
+    : private boost::noncopyable
+{
+public:
+    typedef typename Ptree::key_type::value_type Ch;
+
+    /**
+     * @param pretty Whether the table is indented, as in write_lua.
+     * @param min_nodes The minimum number of nodes of a cached subtree.
+     * Smaller subtrees are formatted whenever their parent is.
+     */
+    explicit lua_serializer(bool pretty = true, std::size_t min_nodes = 16)
+        : pretty_(pretty)
+        , cache_(min_nodes)
+        , last_size_(0)
+    { }
+
+    /**
+     * @brief Writes the ptree as write_lua would.
+     */
+    void write(std::basic_ostream<Ch> &stream, const Ptree &pt)
+    {
+        cache_.prepare(pt);
+
+        // The output size seldom changes much between writes
+        lua_writer<Ptree> writer(pretty_, &cache_);
+        writer.reserve(last_size_);
+        if (!writer.write(pt)) {
+            cache_.abandon();
+            throw lua_parser_error("ptree contains data that cannot be represented in a Lua table", "");
+        }
+        cache_.commit();
+        last_size_ = writer.str().size();
+
+        stream.write(writer.str().data(), writer.str().size());
+        stream.flush();
+    }
+
+    /**
+     * @brief Reports a change to the node at path since the last write.
+     *
+     * The node is formatted again with all its subtree, and so are its
+     * ancestors. Mark the parent of an inserted or erased child. A path
+     * whose key is shared by several children, or is empty, names only the
+     * first of them: to report a change in another, mark an ancestor
+     * named unambiguously. The empty path marks the whole tree.
+     */
+    void mark_dirty(const typename Ptree::path_type &path)
+    {
+        cache_.mark_dirty(path);
+    }
+
+    /**
+     * @brief Forgets the text of the last written tree.
+     */
+    void clear()
+    {
+        cache_.clear();
+    }
+
+private:
+    const bool pretty_;
+    lua_write_cache<Ptree> cache_;
+    std::size_t last_size_;
+};
+
 } // namespace lua_parser
 } // namespace property_tree
 } // namespace golld
@@ -0,0 +1,235 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_DETAIL_LUA_STATE_POOL_HPP_
+#define _GOLLD_PROPERTY_TREE_DETAIL_LUA_STATE_POOL_HPP_
+
+#include <boost/noncopyable.hpp>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "lua_parse_options.hpp"
+#include "lua_parser_error.hpp"
+
+extern "C"
+{
+#include <lua.h>
+}
+
+namespace golld {
+namespace property_tree {
+namespace lua_parser {
+
+/**
+ * @brief A thread-safe and bounded pool of Lua interpreters.
+ *
+ * Creating a Lua state and opening its libraries costs much more than running
+ * a small configuration script. This pool keeps the created states alive
+ * between read_lua calls, restoring their global environment to the one just
+ * after the libraries were opened each time a state is released.
+ *
+ * Only the global table itself is restored. Changes made by a script inside
+ * the library tables (e.g. <tt>string.foo = 1</tt>) are seen by the next user
+ * of the same state.
+ */
+class lua_state_pool
+    : private boost::noncopyable
+{
+public:
+    /**
+     * @brief Constructs an empty pool.
+     *
+     * @param max_size The maximum number of Lua states that the pool will
+     * create. When all of them are in use, acquire blocks until one is
+     * released.
+     * @param options The options of the created states, and of the reads made
+     * with them. The use_arena option is ignored, since the states are long-lived.
+     */
+    explicit lua_state_pool(std::size_t max_size,
+                            const lua_parse_options &options = lua_parse_options())
+        : max_size_(max_size == 0 ? 1 : max_size)
+        , options_(options)
+        , created_(0)
+    {
+        options_.use_arena = false;
+    }
+
+    /**
+     * @brief Closes all idle states.
+     *
+     * All acquired states must have been released before the pool destruction.
+     */
+    ~lua_state_pool()
+    {
+        std::vector<lua_State*>::iterator it = idle_.begin();
+        for (; it != idle_.end(); ++it) {
+            close_lua_state(*it);
+        }
+    }
+
+    /**
+     * @brief Takes a Lua state from the pool, creating it if necessary.
+     *
+     * @return A Lua state with the libraries of options() opened and an empty
+     * stack.
+     */
+    lua_State *acquire()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (idle_.empty() && created_ == max_size_) {
+                available_.wait(lock);
+            }
+
+            if (!idle_.empty()) {
+                lua_State *L = idle_.back();
+                idle_.pop_back();
+                return L;
+            }
+            ++created_;
+        }
+
+        lua_State *L = open_lua_state(options_);
+        if (L == NULL) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --created_;
+            available_.notify_one();
+            throw lua_parser_error("Error on creating Lua environment", "");
+        }
+
+        snapshot_globals(L);
+
+        return L;
+    }
+
+    /**
+     * @brief Gives back to the pool a state returned by acquire.
+     *
+     * @param L The Lua state. Its stack and global environment are reset.
+     */
+    void release(lua_State *L)
+    {
+        reset_globals(L);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_.push_back(L);
+        available_.notify_one();
+    }
+
+    /**
+     * @brief The maximum number of states that this pool will create.
+     */
+    std::size_t max_size() const
+    {
+        return max_size_;
+    }
+
+    /**
+     * @brief The options of the states created by this pool.
+     */
+    const lua_parse_options &options() const
+    {
+        return options_;
+    }
+
+    /**
+     * @brief Holds a state acquired from a pool, releasing it on destruction.
+     */
+    class scoped_state
+        : private boost::noncopyable
+    {
+    public:
+        explicit scoped_state(lua_state_pool &pool)
+            : pool_(pool)
+            , L_(pool.acquire())
+        { }
+
+        ~scoped_state()
+        {
+            pool_.release(L_);
+        }
+
+        lua_State *get() const
+        {
+            return L_;
+        }
+
+    private:
+        lua_state_pool &pool_;
+        lua_State *L_;
+    };
+
+private:
+    static const char *globals_key()
+    {
+        return "golld.property_tree.lua_state_pool.globals";
+    }
+
+    // Stores in the registry a shallow copy of the global table.
+    static void snapshot_globals(lua_State *L)
+    {
+        lua_newtable(L);
+        lua_pushnil(L);
+        while (lua_next(L, LUA_GLOBALSINDEX) != 0) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, -4);
+        }
+        lua_setfield(L, LUA_REGISTRYINDEX, globals_key());
+    }
+
+    // Makes the global table equal to the copy stored by snapshot_globals.
+    static void reset_globals(lua_State *L)
+    {
+        lua_settop(L, 0);
+        lua_getfield(L, LUA_REGISTRYINDEX, globals_key());
+
+        // Clear the globals created by the script. Assigning nil to an
+        // existing field is allowed while traversing a table.
+        lua_pushnil(L);
+        while (lua_next(L, LUA_GLOBALSINDEX) != 0) {
+            lua_pop(L, 1);
+            lua_pushvalue(L, -1);
+            lua_rawget(L, 1);
+            if (lua_isnil(L, -1)) {
+                lua_pushvalue(L, -2);
+                lua_pushnil(L);
+                lua_rawset(L, LUA_GLOBALSINDEX);
+            }
+            lua_pop(L, 1);
+        }
+
+        // Restore the globals overwritten by the script.
+        lua_pushnil(L);
+        while (lua_next(L, 1) != 0) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, LUA_GLOBALSINDEX);
+        }
+
+        lua_pushnil(L);
+        lua_setmetatable(L, LUA_GLOBALSINDEX);
+
+        lua_settop(L, 0);
+    }
+
+    const std::size_t max_size_;
+    lua_parse_options options_;
+    std::size_t created_;
+    std::vector<lua_State*> idle_;
+    std::mutex mutex_;
+    std::condition_variable available_;
+};
+
+} // namespace lua_parser
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_DETAIL_LUA_STATE_POOL_HPP_ */
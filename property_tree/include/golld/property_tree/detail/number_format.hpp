@@ -0,0 +1,170 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_DETAIL_NUMBER_FORMAT_HPP_
+#define _GOLLD_PROPERTY_TREE_DETAIL_NUMBER_FORMAT_HPP_
+
+#include <boost/math/special_functions/sign.hpp>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__has_include)
+#if __has_include(<charconv>) && __cplusplus >= 201703L
+#include <charconv>
+#endif
+#endif
+
+namespace golld {
+namespace property_tree {
+namespace detail {
+
+/// The buffer size needed by the format functions.
+const std::size_t number_buffer_size = 32;
+
+/**
+ * @brief Writes the decimal representation of an integer.
+ *
+ * @param value The integer to format.
+ * @param buffer Where the characters are written, at least number_buffer_size long.
+ *
+ * @return The number of characters written.
+ */
+template <class Integer>
+std::size_t format_integer(Integer value, char *buffer)
+{
+    char digits[number_buffer_size];
+    char *begin = digits + number_buffer_size;
+
+    // Negate digit by digit, so the most negative value does not overflow
+    const bool negative = value < 0;
+    do {
+        const int digit = static_cast<int>(value % 10);
+        *--begin = static_cast<char>('0' + (negative ? -digit : digit));
+        value /= 10;
+    } while (value != 0);
+
+    if (negative) {
+        *--begin = '-';
+    }
+
+    const std::size_t size = digits + number_buffer_size - begin;
+    for (std::size_t i = 0; i < size; ++i) {
+        buffer[i] = begin[i];
+    }
+
+    return size;
+}
+
+#if !defined(__cpp_lib_to_chars)
+// Reads back a number written by format_shortest, in its own precision
+inline double read_back(const char *text, double)
+{
+    return std::strtod(text, NULL);
+}
+
+inline float read_back(const char *text, float)
+{
+#if __cplusplus >= 201103L
+    return std::strtof(text, NULL);
+#else
+    return static_cast<float>(std::strtod(text, NULL));
+#endif
+}
+
+// Writes value with the fewest significant digits, between min_precision
+// and max_precision, which read back to the same value
+template <class Real>
+std::size_t format_shortest(Real value, int min_precision, int max_precision,
+                            char *buffer)
+{
+    int size = 0;
+    for (int precision = min_precision; precision <= max_precision; ++precision) {
+        size = std::snprintf(buffer, number_buffer_size, "%.*g", precision,
+                             static_cast<double>(value));
+        if (read_back(buffer, value) == value) {
+            break;
+        }
+    }
+
+    // The decimal point given by the C locale
+    for (int i = 0; i < size; ++i) {
+        const char c = buffer[i];
+        if ((c < '0' || c > '9') && (c < 'a' || c > 'z') && c != '-' && c != '+') {
+            buffer[i] = '.';
+        }
+    }
+
+    return size;
+}
+#endif
+
+// Whether value is written by format_integer; a negative zero would lose
+// its sign as an integer
+template <class Real>
+bool is_formatted_as_integer(Real value)
+{
+    return value == std::floor(value) && std::fabs(value) < 1e15 &&
+        !(value == 0 && (boost::math::signbit)(value));
+}
+
+/**
+ * @brief Writes the shortest representation of a double that reads back to
+ * the same value.
+ *
+ * Integral values are written without a decimal point or exponent, and a
+ * negative zero as "-0". The output does not depend on the current locale.
+ *
+ * @param value The number to format.
+ * @param buffer Where the characters are written, at least number_buffer_size long.
+ *
+ * @return The number of characters written.
+ */
+inline std::size_t format_double(double value, char *buffer)
+{
+    if (is_formatted_as_integer(value)) {
+        return format_integer(static_cast<long long>(value), buffer);
+    }
+
+#if defined(__cpp_lib_to_chars)
+    return std::to_chars(buffer, buffer + number_buffer_size, value).ptr - buffer;
+#else
+    return format_shortest(value, 15, 17, buffer);
+#endif
+}
+
+/**
+ * @brief Writes the shortest representation of a float that reads back to
+ * the same float.
+ *
+ * As format_double, but the digits are those of the float, so 0.1f is
+ * written as "0.1" and not as the double nearest to it.
+ *
+ * @param value The number to format.
+ * @param buffer Where the characters are written, at least number_buffer_size long.
+ *
+ * @return The number of characters written.
+ */
+inline std::size_t format_float(float value, char *buffer)
+{
+    if (is_formatted_as_integer(value)) {
+        return format_integer(static_cast<long long>(value), buffer);
+    }
+
+#if defined(__cpp_lib_to_chars)
+    return std::to_chars(buffer, buffer + number_buffer_size, value).ptr - buffer;
+#else
+    return format_shortest(value, 6, 9, buffer);
+#endif
+}
+
+} // namespace detail
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_DETAIL_NUMBER_FORMAT_HPP_ */
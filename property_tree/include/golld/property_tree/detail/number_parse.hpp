@@ -0,0 +1,312 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_DETAIL_NUMBER_PARSE_HPP_
+#define _GOLLD_PROPERTY_TREE_DETAIL_NUMBER_PARSE_HPP_
+
+#include <boost/cstdint.hpp>
+#include <boost/predef/other/endian.h>
+#include <algorithm>
+#include <cerrno>
+#include <clocale>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#if defined(__has_include)
+#if __has_include(<charconv>) && __cplusplus >= 201703L
+#include <charconv>
+#endif
+#endif
+
+namespace golld {
+namespace property_tree {
+namespace detail {
+
+// Whether c is white space in the C locale.
+inline bool is_c_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Removes the leading and trailing white space of [first, last), as the
+// stream translator of Boost.PropertyTree accepts it.
+inline void trim_c_space(const char *&first, const char *&last)
+{
+    while (first != last && is_c_space(*first)) {
+        ++first;
+    }
+    while (last != first && is_c_space(*(last - 1))) {
+        --last;
+    }
+}
+
+// The most digits read by parse_digits, whose value always fits in 64 bits.
+const std::size_t max_swar_digits = 19;
+
+// Reads the up to eight digits of [first, first + size) at once. Returns
+// false if any of them is not a decimal digit.
+inline bool parse_eight_digits(const char *first, std::size_t size, boost::uint32_t &value)
+{
+#if BOOST_ENDIAN_LITTLE_BYTE
+    // The digits are right aligned in a word padded with '0', so the first
+    // one is in its lowest byte and the last one in its highest byte
+    char bytes[8] = {'0', '0', '0', '0', '0', '0', '0', '0'};
+    std::memcpy(bytes + 8 - size, first, size);
+    boost::uint64_t word;
+    std::memcpy(&word, bytes, 8);
+
+    // Every byte must be in 0x30-0x3f, and stay below 0x40 when 6 is added
+    if ((word & 0xF0F0F0F0F0F0F0F0ull) != 0x3030303030303030ull ||
+        ((word + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) != 0x3030303030303030ull) {
+        return false;
+    }
+
+    // Combine pairs of digits, then pairs of pairs, then the two halves
+    word -= 0x3030303030303030ull;
+    word = word * 10 + (word >> 8);
+    word = ((word & 0x000000FF000000FFull) * (100 + (1000000ull << 32)) +
+            ((word >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32))) >> 32;
+    value = static_cast<boost::uint32_t>(word);
+    return true;
+#else
+    boost::uint32_t result = 0;
+    for (const char *last = first + size; first != last; ++first) {
+        const unsigned digit = static_cast<unsigned char>(*first) - '0';
+        if (digit > 9) {
+            return false;
+        }
+        result = result * 10 + digit;
+    }
+    value = result;
+    return true;
+#endif
+}
+
+// Reads [first, last), of at most max_swar_digits decimal digits, eight
+// digits at a time.
+inline bool parse_digits(const char *first, const char *last, boost::uint64_t &value)
+{
+    // The first block takes the digits in excess of a multiple of eight
+    std::size_t size = (last - first) % 8;
+    if (size == 0) {
+        size = 8;
+    }
+
+    boost::uint64_t result = 0;
+    for (; first != last; first += size, size = 8) {
+        boost::uint32_t block;
+        if (!parse_eight_digits(first, size, block)) {
+            return false;
+        }
+        result = result * 100000000u + block;
+    }
+
+    value = result;
+    return true;
+}
+
+/**
+ * @brief Parses a decimal integer, with optional sign and surrounding white
+ * space, independently of the current locale.
+ *
+ * @return Whether the whole range was a number which fits in an Integer.
+ */
+template <class Integer>
+bool parse_integer(const char *first, const char *last, Integer &value)
+{
+    typedef std::numeric_limits<Integer> limits;
+
+    trim_c_space(first, last);
+
+    bool negative = false;
+    if (first != last && (*first == '-' || *first == '+')) {
+        negative = *first == '-';
+        ++first;
+    }
+    if (first == last) {
+        return false;
+    }
+
+    // Longer numbers, as those with many leading zeros, are read digit by digit
+    if (static_cast<std::size_t>(last - first) <= max_swar_digits) {
+        boost::uint64_t magnitude;
+        if (!parse_digits(first, last, magnitude)) {
+            return false;
+        }
+
+        if (!negative) {
+            if (magnitude > static_cast<boost::uint64_t>(limits::max())) {
+                return false;
+            }
+            value = static_cast<Integer>(magnitude);
+        }
+        else if (magnitude == 0) {
+            value = 0;
+        }
+        else {
+            // Negate one less than the magnitude, which always fits
+            if (!limits::is_signed ||
+                magnitude - 1 > static_cast<boost::uint64_t>(limits::max())) {
+                return false;
+            }
+            value = static_cast<Integer>(-static_cast<Integer>(magnitude - 1) - 1);
+        }
+        return true;
+    }
+
+    // Only zero can be negative in an unsigned type
+    if (negative && !limits::is_signed) {
+        for (; first != last; ++first) {
+            if (*first != '0') {
+                return false;
+            }
+        }
+        value = 0;
+        return true;
+    }
+
+    // Accumulate towards the sign, so the most negative value does not overflow
+    Integer result = 0;
+    for (; first != last; ++first) {
+        const unsigned digit = static_cast<unsigned>(*first) - '0';
+        if (digit > 9) {
+            return false;
+        }
+
+        if (negative) {
+            if (result < (limits::min() + static_cast<Integer>(digit)) / 10) {
+                return false;
+            }
+            result = static_cast<Integer>(result * 10 - static_cast<Integer>(digit));
+        }
+        else {
+            if (result > (limits::max() - static_cast<Integer>(digit)) / 10) {
+                return false;
+            }
+            result = static_cast<Integer>(result * 10 + static_cast<Integer>(digit));
+        }
+    }
+
+    value = result;
+    return true;
+}
+
+/**
+ * @brief Parses a decimal floating point number, with optional sign and
+ * surrounding white space, independently of the current locale.
+ *
+ * @return Whether the whole range was a number in the double range.
+ */
+inline bool parse_double(const char *first, const char *last, double &value)
+{
+    trim_c_space(first, last);
+
+    // Neither from_chars nor the stream accept a sign alone
+    if (first != last && *first == '+') {
+        ++first;
+        if (first != last && (*first == '-' || *first == '+')) {
+            return false;
+        }
+    }
+    // Neither infinity, NaN nor hexadecimal numbers are accepted by the stream
+    const char *digits = first != last && *first == '-' ? first + 1 : first;
+    if (digits == last || ((*digits < '0' || *digits > '9') && *digits != '.') ||
+        std::find(digits, last, 'x') != last || std::find(digits, last, 'X') != last) {
+        return false;
+    }
+
+    // Clinger's fast path: a decimal without exponent, whose digits fit in
+    // the 53 bits of the mantissa and whose fraction has at most 22 digits,
+    // is the exact quotient of two doubles, so one division rounds it right
+    {
+        static const double powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        const char *point = std::find(digits, last, '.');
+        const char *fraction = point == last ? last : point + 1;
+        const std::size_t integer_size = point - digits;
+        const std::size_t fraction_size = last - fraction;
+
+        boost::uint64_t integer = 0;
+        boost::uint64_t decimals = 0;
+        if (integer_size + fraction_size != 0 &&
+            integer_size + fraction_size <= max_swar_digits &&
+            (integer_size == 0 || parse_digits(digits, point, integer)) &&
+            (fraction_size == 0 || parse_digits(fraction, last, decimals))) {
+            const boost::uint64_t mantissa =
+                integer * static_cast<boost::uint64_t>(powers[fraction_size]) + decimals;
+            if (mantissa <= (boost::uint64_t(1) << 53)) {
+                const double result = static_cast<double>(mantissa) / powers[fraction_size];
+                value = digits == first ? result : -result;
+                return true;
+            }
+        }
+    }
+
+#if defined(__cpp_lib_to_chars)
+    const std::from_chars_result result = std::from_chars(first, last, value);
+    return result.ec == std::errc() && result.ptr == last;
+#else
+    // strtod reads the decimal point of the C locale, so it is put in a copy
+    const char point = *std::localeconv()->decimal_point;
+    std::string copy(first, last);
+    for (std::size_t i = 0; i < copy.size(); ++i) {
+        if (copy[i] == '.') {
+            copy[i] = point;
+        }
+        else if (copy[i] == point) {
+            return false;
+        }
+    }
+
+    char *end;
+    errno = 0;
+    const double result = std::strtod(copy.c_str(), &end);
+    if (end != copy.c_str() + copy.size() || errno == ERANGE) {
+        return false;
+    }
+
+    value = result;
+    return true;
+#endif
+}
+
+/**
+ * @brief Parses a boolean as the stream translator does: @c true, @c false,
+ * @c 1 or @c 0, with optional surrounding white space.
+ */
+inline bool parse_bool(const char *first, const char *last, bool &value)
+{
+    trim_c_space(first, last);
+
+    const std::size_t size = last - first;
+    if (size == 1 && (*first == '1' || *first == '0')) {
+        value = *first == '1';
+    }
+    else if (size == 4 && std::equal(first, last, "true")) {
+        value = true;
+    }
+    else if (size == 5 && std::equal(first, last, "false")) {
+        value = false;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace detail
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_DETAIL_NUMBER_PARSE_HPP_ */
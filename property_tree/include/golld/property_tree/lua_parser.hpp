@@ -9,12 +9,19 @@
 #define _GOLLD_PROPERTY_TREE_LUA_PARSER_HPP_
 
 #include <boost/property_tree/ptree.hpp>
+#include <golld/property_tree/detail/lua_chunk_cache.hpp>
+#include <golld/property_tree/detail/lua_parser_batch.hpp>
+#include <golld/property_tree/detail/lua_parse_options.hpp>
 #include <golld/property_tree/detail/lua_parser_error.hpp>
+#include <golld/property_tree/detail/lua_parser_push.hpp>
 #include <golld/property_tree/detail/lua_parser_read.hpp>
 #include <golld/property_tree/detail/lua_parser_write.hpp>
+#include <golld/property_tree/detail/lua_state_pool.hpp>
 #include <string>
 #include <ostream>
+#include <cstddef>
 #include <fstream>
+#include <vector>
 
 namespace golld {
 namespace property_tree {
@@ -24,39 +31,210 @@ template<typename Ptree>
 void read_lua(std::basic_istream<typename Ptree::key_type::value_type> &stream,
               const std::string &rootKey,  Ptree &pt)
 {
-    read_lua_internal(stream, rootKey, pt, std::string());
+    read_lua_internal(stream, rootKey, pt, std::string(), lua_parse_options());
 }
 
 template<class Ptree>
 void read_lua(const std::string &filename, const std::string &rootKey, Ptree &pt,
               const std::locale &loc = std::locale())
 {
-    std::basic_ifstream<typename Ptree::key_type::value_type> stream(filename.c_str());
+    read_lua_internal(filename, rootKey, pt, loc, lua_parse_options());
+}
+
+template<typename Ptree>
+void read_lua(std::basic_istream<typename Ptree::key_type::value_type> &stream,
+              const std::string &rootKey, Ptree &pt, const lua_parse_options &options)
+{
+    read_lua_internal(stream, rootKey, pt, std::string(), options);
+}
+
+template<class Ptree>
+void read_lua(const std::string &filename, const std::string &rootKey, Ptree &pt,
+              const lua_parse_options &options, const std::locale &loc = std::locale())
+{
+    read_lua_internal(filename, rootKey, pt, loc, options);
+}
+
+template<typename Ptree>
+void read_lua(std::basic_istream<typename Ptree::key_type::value_type> &stream,
+              const std::string &rootKey, Ptree &pt, lua_state_pool &pool)
+{
+    read_lua_internal(stream, rootKey, pt, std::string(), pool);
+}
+
+template<class Ptree>
+void read_lua(const std::string &filename, const std::string &rootKey, Ptree &pt,
+              lua_state_pool &pool, const std::locale &loc = std::locale())
+{
+    read_lua_internal(filename, rootKey, pt, loc, pool);
+}
+
+template<class Ptree>
+void read_lua(const std::string &filename, const std::string &rootKey, Ptree &pt,
+              lua_chunk_cache &cache)
+{
+    read_lua_internal(filename, rootKey, pt, cache);
+}
+
+template<class Ptree>
+void read_lua(const std::string &filename, const std::string &rootKey, Ptree &pt,
+              lua_chunk_cache &cache, lua_state_pool &pool)
+{
+    read_lua_internal(filename, rootKey, pt, cache, pool);
+}
+
+/**
+ * @brief Reads several Lua tables from one execution of a script.
+ *
+ * Each table is translated to a child of @c pt, whose key is the table name,
+ * as read_lua would translate it. When @c rootKeys is empty, all the table
+ * globals created or replaced by the script are read, sorted by name.
+ */
+template<class Ptree>
+void read_lua_multi(std::basic_istream<typename Ptree::key_type::value_type> &stream,
+                    const std::vector<std::string> &rootKeys, Ptree &pt,
+                    const lua_parse_options &options = lua_parse_options())
+{
+    read_lua_internal(stream, rootKeys, pt, std::string(), options);
+}
+
+template<class Ptree>
+void read_lua_multi(const std::string &filename, const std::vector<std::string> &rootKeys,
+                    Ptree &pt, const std::locale &loc = std::locale())
+{
+    read_lua_internal(filename, rootKeys, pt, loc, lua_parse_options());
+}
+
+template<class Ptree>
+void read_lua_multi(const std::string &filename, const std::vector<std::string> &rootKeys,
+                    Ptree &pt, const lua_parse_options &options,
+                    const std::locale &loc = std::locale())
+{
+    read_lua_internal(filename, rootKeys, pt, loc, options);
+}
+
+/**
+ * @brief Reads many Lua files in parallel.
+ *
+ * The jobs are shared by a number of worker threads, each one with its own Lua
+ * state. An error in one file is stored in its result and does not stop the
+ * other jobs.
+ *
+ * @param jobs The files and the names of their tables to translate.
+ * @param results Receives one result for each job, in the same order.
+ * @param threads The number of workers. Zero uses one for each hardware thread.
+ * @param options The options of the Lua states. The use_arena option is ignored.
+ * @param loc The locale used to read the files.
+ */
+template<class Ptree>
+void read_lua_batch(const std::vector<lua_read_job> &jobs,
+                    std::vector<lua_read_result<Ptree> > &results,
+                    std::size_t threads = 0,
+                    const lua_parse_options &options = lua_parse_options(),
+                    const std::locale &loc = std::locale())
+{
+    read_lua_batch_internal(jobs, results, threads, options, loc);
+}
+
+/**
+ * @brief Translates a table held by a running Lua state to a ptree.
+ *
+ * No script is run and the stack of @c L is left as it was. Only the table
+ * children are put in @c pt, which has no data.
+ *
+ * @param L The Lua state.
+ * @param index The stack index of the table. Pseudo-indices are accepted.
+ * @param pt The ptree receiving the table.
+ * @param max_depth The maximum nesting of the translated tables.
+ */
+template<class Ptree>
+void read_lua_table(lua_State *L, int index, Ptree &pt,
+                    std::size_t max_depth = default_max_depth)
+{
+    read_lua_table_internal(L, index, pt, max_depth);
+}
+
+/**
+ * @brief Pushes a ptree onto the Lua stack as a read-only userdata.
+ *
+ * The tree is not copied. Indexing the userdata with a key, or with a number
+ * which is formatted as read_lua does, gives the data string of a leaf child
+ * or another userdata for a child with children. The # operator gives the
+ * number of children, and <tt>for k, v in pairs(t)</tt> (Lua 5.2 or later) or
+ * <tt>for k, v in t() do</tt> traverses them in order.
+ *
+ * The userdata holds a pointer to @c pt, so the tree must not be changed or
+ * destroyed while the Lua state can still reach it.
+ *
+ * @param L The Lua state.
+ * @param pt The ptree to push. Its key and data types must be char strings.
+ */
+template<class Ptree>
+void push_ptree(lua_State *L, const Ptree &pt)
+{
+    push_ptree_internal(L, pt);
+}
+
+/**
+ * @brief Writes a ptree as a Lua script which creates a global table.
+ *
+ * The root data is the table name, and the other nodes must have either data
+ * or children.
+ *
+ * @param stream The stream where the script is written.
+ * @param pt The ptree to write.
+ * @param pretty Whether the table is indented, one entry per line. Otherwise
+ * no whitespace is written.
+ */
+template<class Ptree>
+void write_lua(std::basic_ostream<typename Ptree::key_type::value_type> &stream,
+               const Ptree &pt, bool pretty = true)
+{
+    write_lua_internal(stream, pt, std::string(), pretty);
+}
+
+template<class Ptree>
+void write_lua(const std::string &filename, const Ptree &pt,
+               const std::locale &loc = std::locale(), bool pretty = true)
+{
+    std::basic_ofstream<typename Ptree::key_type::value_type> stream(filename.c_str());
     if (!stream) {
         throw lua_parser_error("cannot open file", filename);
     }
     stream.imbue(loc);
 
-    read_lua_internal(stream, rootKey, pt, filename);
+    write_lua_internal(stream, pt, filename, pretty);
 }
 
+/**
+ * @brief Writes a ptree as a precompiled Lua chunk.
+ *
+ * The chunk, in the lua_dump format, creates the same global table as the
+ * script written by write_lua, and can be read by read_lua without being
+ * parsed. It can only be loaded by the Lua version, and the same kind of
+ * platform, which wrote it.
+ *
+ * Lua limits the number of constants of a chunk, so very large trees may
+ * not be compiled. A lua_parser_error is then thrown.
+ *
+ * @param stream The binary stream where the chunk is written.
+ * @param pt The ptree to write. Its key type must be a char string.
+ */
 template<class Ptree>
-void write_lua(std::basic_ostream<typename Ptree::key_type::value_type> &stream,
-               const Ptree &pt)
+void write_lua_bytecode(std::ostream &stream, const Ptree &pt)
 {
-    write_lua_internal(stream, pt, std::string());
+    write_lua_bytecode_internal(stream, pt, std::string());
 }
 
 template<class Ptree>
-void write_lua(const std::string &filename, const Ptree &pt, const std::locale &loc = std::locale())
+void write_lua_bytecode(const std::string &filename, const Ptree &pt)
 {
-    std::basic_ofstream<typename Ptree::key_type::value_type> stream(filename.c_str());
+    std::ofstream stream(filename.c_str(), std::ios::out | std::ios::binary);
     if (!stream) {
         throw lua_parser_error("cannot open file", filename);
     }
-    stream.imbue(loc);
 
-    write_lua_internal(stream, pt, filename);
+    write_lua_bytecode_internal(stream, pt, filename);
 }
 
 } // namespace lua_parser
@@ -67,8 +245,31 @@ namespace golld {
 namespace property_tree {
 
 using lua_parser::read_lua;
+using lua_parser::read_lua_multi;
+using lua_parser::read_lua_batch;
+using lua_parser::read_lua_table;
+using lua_parser::push_ptree;
 using lua_parser::write_lua;
+using lua_parser::write_lua_bytecode;
+using lua_parser::lua_chunk_cache;
 using lua_parser::lua_parser_error;
+using lua_parser::lua_parse_options;
+using lua_parser::lua_library;
+using lua_parser::lua_no_libs;
+using lua_parser::lua_base_lib;
+using lua_parser::lua_package_lib;
+using lua_parser::lua_table_lib;
+using lua_parser::lua_io_lib;
+using lua_parser::lua_os_lib;
+using lua_parser::lua_string_lib;
+using lua_parser::lua_math_lib;
+using lua_parser::lua_debug_lib;
+using lua_parser::lua_all_libs;
+using lua_parser::lua_read_job;
+using lua_parser::lua_read_result;
+using lua_parser::lua_serializer;
+using lua_parser::lua_state_pool;
+using lua_parser::lua_table_reader;
 
 } // namespace property_tree
 } // namespace golld
@@ -0,0 +1,81 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_PMR_PTREE_HPP_
+#define _GOLLD_PROPERTY_TREE_PMR_PTREE_HPP_
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <functional>
+#include <string>
+
+#if defined(__has_include)
+#if __has_include(<memory_resource>) && __cplusplus >= 201703L
+#include <memory_resource>
+#endif
+#endif
+
+#if defined(__cpp_lib_memory_resource)
+
+namespace golld {
+namespace property_tree {
+namespace pmr {
+
+/**
+ * @brief A ptree whose keys and data are std::pmr::string.
+ *
+ * basic_ptree creates its strings without an allocator argument, and copies
+ * them with the allocator given by select_on_container_copy_construction, so
+ * they take their memory from the default memory resource. Building a tree
+ * inside a default_resource_scope of a monotonic_buffer_resource thus puts
+ * all its strings in one arena, released at once with the resource.
+ *
+ * The nodes of the child containers are still taken from std::allocator,
+ * since basic_ptree has no allocator parameter.
+ *
+ * The golld functions templated on the ptree type (assign::basic_tree,
+ * toSequence, toArray, graphUnion, read_lua, write_lua, operator<<) accept
+ * this type.
+ */
+typedef boost::property_tree::basic_ptree<std::pmr::string, std::pmr::string,
+                                          std::less<std::pmr::string> > ptree;
+
+/**
+ * @brief Makes a memory resource the default one while alive.
+ *
+ * basic_ptree gives no way to pass a resource to the strings it creates, so
+ * this scope changes the default resource of the whole process. It is not
+ * thread safe: a pmr string created without an explicit resource by any
+ * other thread while the scope is alive takes its memory from the given
+ * resource too, and is left dangling when the resource is released. Use it
+ * only while no other thread creates such strings, and destroy the strings
+ * made within the scope before the resource.
+ */
+class default_resource_scope
+    : private boost::noncopyable
+{
+public:
+    explicit default_resource_scope(std::pmr::memory_resource *resource)
+        : previous_(std::pmr::set_default_resource(resource))
+    { }
+
+    ~default_resource_scope()
+    {
+        std::pmr::set_default_resource(previous_);
+    }
+
+private:
+    std::pmr::memory_resource *const previous_;
+};
+
+} // namespace pmr
+} // namespace property_tree
+} // namespace golld
+
+#endif
+
+#endif /* _GOLLD_PROPERTY_TREE_PMR_PTREE_HPP_ */
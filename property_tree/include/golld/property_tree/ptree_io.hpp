@@ -13,15 +13,17 @@
 #include <string>
 
 /// Prints a ptree with a possible prefix spacing if it was a subtree.
-template <class charT, class traits>
+template <class charT, class traits, class Key, class Data, class Compare>
 void insertion(std::basic_ostream<charT,traits> &strm,
-    const boost::property_tree::ptree &ptree, const std::string &prefix)
+    const boost::property_tree::basic_ptree<Key, Data, Compare> &ptree, const std::string &prefix)
 {
+    typedef boost::property_tree::basic_ptree<Key, Data, Compare> Ptree;
+
     strm << prefix << ptree.data() << '\n'
          << prefix << "{\n";
 
-    boost::property_tree::ptree::const_iterator it = ptree.begin();
-    const boost::property_tree::ptree::const_iterator end = ptree.end();
+    typename Ptree::const_iterator it = ptree.begin();
+    const typename Ptree::const_iterator end = ptree.end();
     for (; it != end; ++it) {
         strm << prefix << it->first << " =\n";
         insertion(strm, it->second, prefix + '\t');
@@ -30,6 +32,15 @@ void insertion(std::basic_ostream<charT,traits> &strm,
     strm << prefix << '}';
 }
 
+template <class charT, class traits, class Key, class Data, class Compare>
+inline std::basic_ostream<charT,traits>&
+operator<<(std::basic_ostream<charT,traits> &strm,
+           const boost::property_tree::basic_ptree<Key, Data, Compare> &ptree)
+{
+    insertion(strm, ptree, "");
+    return strm;
+}
+
 template <class charT, class traits>
 inline std::basic_ostream<charT,traits>&
 operator<<(std::basic_ostream<charT,traits> &strm, const boost::property_tree::ptree &ptree)
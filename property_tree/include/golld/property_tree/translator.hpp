@@ -0,0 +1,165 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#ifndef _GOLLD_PROPERTY_TREE_TRANSLATOR_HPP_
+#define _GOLLD_PROPERTY_TREE_TRANSLATOR_HPP_
+
+#include <boost/optional.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <string>
+
+#include <golld/property_tree/detail/number_format.hpp>
+#include <golld/property_tree/detail/number_parse.hpp>
+
+namespace golld {
+namespace property_tree {
+
+namespace detail {
+
+// The types converted by arithmetic_translator. The character types are left
+// out, since the stream translator reads and writes them as characters.
+template <class T> struct is_translated_number : boost::false_type { };
+template <> struct is_translated_number<bool> : boost::true_type { };
+template <> struct is_translated_number<short> : boost::true_type { };
+template <> struct is_translated_number<unsigned short> : boost::true_type { };
+template <> struct is_translated_number<int> : boost::true_type { };
+template <> struct is_translated_number<unsigned int> : boost::true_type { };
+template <> struct is_translated_number<long> : boost::true_type { };
+template <> struct is_translated_number<unsigned long> : boost::true_type { };
+template <> struct is_translated_number<long long> : boost::true_type { };
+template <> struct is_translated_number<unsigned long long> : boost::true_type { };
+template <> struct is_translated_number<float> : boost::true_type { };
+template <> struct is_translated_number<double> : boost::true_type { };
+
+template <class Integer>
+bool parse_number(const char *first, const char *last, Integer &value)
+{
+    return parse_integer(first, last, value);
+}
+
+inline bool parse_number(const char *first, const char *last, bool &value)
+{
+    return parse_bool(first, last, value);
+}
+
+inline bool parse_number(const char *first, const char *last, double &value)
+{
+    return parse_double(first, last, value);
+}
+
+inline bool parse_number(const char *first, const char *last, float &value)
+{
+    // The values from the largest float up to half its ulp above round to it
+    typedef std::numeric_limits<float> limits;
+    const double limit = limits::max() +
+        std::ldexp(1.0, limits::max_exponent - limits::digits - 1);
+
+    double result;
+    if (!parse_double(first, last, result) || result >= limit || result <= -limit) {
+        return false;
+    }
+
+    value = static_cast<float>(result);
+    return true;
+}
+
+template <class Integer>
+std::size_t format_number(Integer value, char *buffer)
+{
+    return format_integer(value, buffer);
+}
+
+inline std::size_t format_number(bool value, char *buffer)
+{
+    static const char true_string[] = "true";
+    static const char false_string[] = "false";
+
+    const char *word = value ? true_string : false_string;
+    const std::size_t size = value ? 4 : 5;
+    std::copy(word, word + size, buffer);
+    return size;
+}
+
+inline std::size_t format_number(double value, char *buffer)
+{
+    return format_double(value, buffer);
+}
+
+inline std::size_t format_number(float value, char *buffer)
+{
+    return format_float(value, buffer);
+}
+
+} // namespace detail
+
+/**
+ * @brief A ptree translator between char strings and the integral, floating
+ * point and bool types.
+ *
+ * It reads and writes the same texts as the default stream translator, but
+ * with locale-independent routines which build no stream and allocate no
+ * memory. Floating point values are written with the fewest digits which
+ * read back to the same value.
+ *
+ * @code
+ * int i = pt.get_value<int>(arithmetic_translator<std::string, int>());
+ * @endcode
+ */
+template <class String, class T>
+class arithmetic_translator
+{
+public:
+    typedef String internal_type;
+    typedef T external_type;
+
+    boost::optional<T> get_value(const String &str) const
+    {
+        T value;
+        if (!detail::parse_number(str.data(), str.data() + str.size(), value)) {
+            return boost::optional<T>();
+        }
+        return value;
+    }
+
+    boost::optional<String> put_value(const T &value) const
+    {
+        char buffer[detail::number_buffer_size];
+        const std::size_t size = detail::format_number(value, buffer);
+        return String(buffer, buffer + size);
+    }
+};
+
+/**
+ * @brief The translator used by the golld helpers between a ptree data type
+ * and T.
+ *
+ * It is arithmetic_translator for char strings and the types it converts,
+ * and the Boost.PropertyTree default translator otherwise.
+ */
+template <class String, class T, class Enable = void>
+struct translator_for
+{
+    typedef typename boost::property_tree::translator_between<String, T>::type type;
+};
+
+template <class Traits, class Alloc, class T>
+struct translator_for<std::basic_string<char, Traits, Alloc>, T,
+                      typename boost::enable_if<detail::is_translated_number<T> >::type>
+{
+    typedef arithmetic_translator<std::basic_string<char, Traits, Alloc>, T> type;
+};
+
+} // namespace property_tree
+} // namespace golld
+
+#endif /* _GOLLD_PROPERTY_TREE_TRANSLATOR_HPP_ */
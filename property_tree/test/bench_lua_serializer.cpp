@@ -0,0 +1,98 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#include <golld/property_tree/lua_parser.hpp>
+
+#include <boost/property_tree/ptree.hpp>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace bpt = boost::property_tree;
+namespace gpt = golld::property_tree;
+
+namespace {
+
+const int iterations = 50;
+
+// A table of tables, each with fanout children, down to the given depth
+bpt::ptree make_tree(int depth, int fanout)
+{
+    bpt::ptree pt;
+    for (int i = 0; i < fanout; ++i) {
+        const std::string key = "key" + std::to_string(i);
+        if (depth > 1) {
+            pt.push_back(std::make_pair(key, make_tree(depth - 1, fanout)));
+        }
+        else {
+            pt.push_back(std::make_pair(key, bpt::ptree("value " + std::to_string(i))));
+        }
+    }
+    return pt;
+}
+
+// Changes one leaf at each write, and writes the whole tree
+template <class Write>
+double per_write_ms(bpt::ptree &pt, const std::string &leaf, Write write)
+{
+    typedef std::chrono::steady_clock clock;
+
+    const clock::time_point start = clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        pt.put(leaf, i);
+        std::ostringstream stream;
+        write(stream, pt, leaf);
+    }
+    const clock::duration elapsed = clock::now() - start;
+
+    return std::chrono::duration<double, std::milli>(elapsed).count() / iterations;
+}
+
+struct write_plain
+{
+    void operator()(std::ostream &stream, const bpt::ptree &pt, const std::string &) const
+    {
+        gpt::write_lua(stream, pt);
+    }
+};
+
+struct write_serializer
+{
+    gpt::lua_serializer<bpt::ptree> *serializer;
+
+    void operator()(std::ostream &stream, const bpt::ptree &pt, const std::string &leaf) const
+    {
+        serializer->mark_dirty(leaf);
+        serializer->write(stream, pt);
+    }
+};
+
+void compare(const char *name, int depth, int fanout, const std::string &leaf)
+{
+    bpt::ptree pt = make_tree(depth, fanout);
+    pt.put_value("root");
+
+    gpt::lua_serializer<bpt::ptree> serializer;
+    std::ostringstream first;
+    serializer.write(first, pt);
+    write_serializer cached = {&serializer};
+
+    std::cout << name << " tree, " << first.str().size() / 1024 << " KiB:\n";
+    std::cout << "  write_lua:      " << per_write_ms(pt, leaf, write_plain()) << " ms/write\n";
+    std::cout << "  lua_serializer: " << per_write_ms(pt, leaf, cached) << " ms/write" << std::endl;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    compare("Shallow", 2, 500, "key250.key250");
+    compare("Deep", 6, 6, "key3.key3.key3.key3.key3.key3");
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+/* Copyright (C) 2011 Renato Florentino Garcia
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See
+ * accompanying file BOOST_LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ * For more information, see http://www.boost.org
+ */
+#include <golld/property_tree/lua_parser.hpp>
+
+#include <boost/property_tree/ptree.hpp>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+namespace bpt = boost::property_tree;
+namespace gpt = golld::property_tree;
+
+namespace {
+
+const char script[] =
+    "tenant = {\n"
+    "    name = 'tenant',\n"
+    "    port = 8080,\n"
+    "    enabled = true,\n"
+    "    hosts = {'a', 'b', 'c'},\n"
+    "}\n";
+
+const int iterations = 5000;
+
+template <class Function>
+double per_call_us(Function read)
+{
+    typedef std::chrono::steady_clock clock;
+
+    const clock::time_point start = clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        read();
+    }
+    const clock::duration elapsed = clock::now() - start;
+
+    return std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+}
+
+struct read_without_pool
+{
+    void operator()() const
+    {
+        std::istringstream stream(script);
+        bpt::ptree pt;
+        gpt::read_lua(stream, "tenant", pt);
+    }
+};
+
+struct read_with_pool
+{
+    gpt::lua_state_pool *pool;
+
+    void operator()() const
+    {
+        std::istringstream stream(script);
+        bpt::ptree pt;
+        gpt::read_lua(stream, "tenant", pt, *pool);
+    }
+};
+
+}
+
+int main(int argc, char *argv[])
+{
+    gpt::lua_state_pool pool(1);
+    read_with_pool with_pool = {&pool};
+
+    std::cout << "read_lua without pool: " << per_call_us(read_without_pool()) << " us/call\n";
+    std::cout << "read_lua with pool:    " << per_call_us(with_pool) << " us/call" << std::endl;
+
+    return 0;
+}
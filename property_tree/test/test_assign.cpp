@@ -8,10 +8,71 @@
 #include <boost/property_tree/ptree.hpp>
 
 #include <golld/property_tree/assign.hpp>
+#include <golld/property_tree/pmr_ptree.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
 
 namespace bpt = boost::property_tree;
+namespace gpt = golld::property_tree;
 using namespace golld::property_tree::assign;
 
+#if __cplusplus >= 201103L
+// A data type counting its copies, to check that subtrees are moved
+struct counted
+{
+    counted()
+    { }
+
+    counted(const char *s)
+        : s(s)
+    { }
+
+    counted(const counted &other)
+        : s(other.s)
+    {
+        copies += !s.empty();
+    }
+
+    counted(counted &&other)
+        : s(std::move(other.s))
+    { }
+
+    counted & operator=(const counted &other)
+    {
+        s = other.s;
+        copies += !s.empty();
+        return *this;
+    }
+
+    counted & operator=(counted &&other)
+    {
+        s = std::move(other.s);
+        return *this;
+    }
+
+    bool operator==(const counted &other) const
+    {
+        return s == other.s;
+    }
+
+    std::string s;
+    static int copies;
+};
+
+int counted::copies = 0;
+#endif
+
+// Takes a tree by non-const reference, as the ptree functions which fill one
+static std::size_t count_and_clear(bpt::ptree &pt)
+{
+    const std::size_t size = pt.size();
+    pt.clear();
+    return size;
+}
+
 int main(int argc, char *argv[])
 {
     bpt::ptree pt1;
@@ -50,6 +111,84 @@ int main(int argc, char *argv[])
             ("key5", "value5")
             (10)(11)(12));
 
-    if (pt1 == pt2) return 0;
-    else return 1;
+    if (pt1 != pt2) return 1;
+
+    // A named tree is copied, and left unchanged
+    tree subtree = tree()("key4", "value4");
+    bpt::ptree pt3 = tree()("a", subtree)(subtree);
+    const bpt::ptree &pt4 = subtree;
+    if (pt3.get<std::string>("a.key4") != "value4" || pt3.size() != 2 ||
+        pt4.get<std::string>("key4") != "value4") return 1;
+
+    // A temporary tree binds to a non-const ptree reference
+    bpt::ptree swapped;
+    swapped.swap(tree()(1)(2));
+    if (swapped.size() != 2 || swapped.back().second.data() != "2" ||
+        count_and_clear(tree()(1)(2)(3)) != 3) return 1;
+
+#if __cplusplus >= 201103L
+    {
+        typedef bpt::basic_ptree<std::string, counted> counted_ptree;
+        typedef basic_tree<counted_ptree> counted_tree;
+
+        // Only the data given to the constructors is copied, once each
+        counted::copies = 0;
+        const counted_ptree pt5 =
+            counted_tree(counted("root"))
+            ("a", counted_tree(counted("x"))
+                (counted_tree(counted("y"))))
+            (counted_tree(counted("z")));
+        if (counted::copies != 4 || pt5.size() != 2 || pt5.data().s != "root" ||
+            pt5.get_child("a").data().s != "x" ||
+            pt5.get_child("a").begin()->second.data().s != "y") return 1;
+
+        // A moved basic_tree is left empty
+        counted_tree source(counted("w"));
+        source(counted_tree(counted("v")));
+        counted_tree target(std::move(source));
+        const counted_ptree &moved = source;
+        const counted_ptree &taken = target;
+        if (counted::copies != 6 || !moved.data().s.empty() || !moved.empty() ||
+            taken.data().s != "w" || taken.size() != 1) return 1;
+    }
+#endif
+
+#if defined(__cpp_lib_memory_resource)
+    {
+        // A subtree of another resource is copied into its parent, not swapped
+        typedef basic_tree<gpt::pmr::ptree> pmr_tree;
+        const std::pmr::string data(40, 'd');
+
+        std::pmr::monotonic_buffer_resource arena;
+        std::unique_ptr<pmr_tree> child;
+        {
+            gpt::pmr::default_resource_scope scope(&arena);
+            child.reset(new pmr_tree(gpt::pmr::ptree::data_type(data)));
+            (*child)("key", "value");
+        }
+
+        const gpt::pmr::ptree pt6 = pmr_tree()("child", std::move(*child));
+        const gpt::pmr::ptree &copied = pt6.get_child("child");
+        if (copied.data() != data || copied.get<std::pmr::string>("key") != "value" ||
+            copied.data().get_allocator().resource() != std::pmr::get_default_resource())
+            return 1;
+    }
+#endif
+
+#if __cplusplus >= 201103L
+    // The same tree as pt1, with its shape known at compile time
+    static constexpr auto literal1 = literal(
+        entry("key1", "value1"),
+        entry("key2", literal(
+            entry("key3", 12345),
+            entry(literal(
+                entry("key4", "value4 with spaces"))),
+            entry("key5", "value5"),
+            entry(10), entry(11), entry(12))));
+    static_assert(decltype(literal1)::node_count == 10, "wrong node count");
+
+    if (literal1.build<bpt::ptree>() != pt1) return 1;
+#endif
+
+    return 0;
 }
@@ -5,12 +5,27 @@
  * http://www.boost.org/LICENSE_1_0.txt)
  * For more information, see http://www.boost.org
  */
+#include <algorithm>
 #include <boost/array.hpp>
+#include <boost/foreach.hpp>
+#include <boost/next_prior.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/range/adaptor/reversed.hpp>
+#include <iterator>
+#include <list>
+#include <string>
 #include <vector>
 
+#if defined(__has_include)
+#if __has_include(<ranges>) && __cplusplus >= 202002L
+#include <ranges>
+#endif
+#endif
+
 #include <golld/property_tree/assign.hpp>
 #include <golld/property_tree/conversion.hpp>
+#include <golld/property_tree/pmr_ptree.hpp>
+#include <golld/property_tree/translator.hpp>
 
 namespace bpt = boost::property_tree;
 namespace gpt = golld::property_tree;
@@ -62,5 +77,169 @@ int main(int argc, char *argv[])
         if (result != pt1) return -1;
     }
 
+    {
+        // Numbers and booleans are read and written without streams
+        const bpt::ptree pt = tree()(0.5)(" -2.25e1 ")(1e300);
+        const std::vector<double> result = gpt::toSequence<std::vector<double> >(pt);
+        if (result.size() != 3 || result[0] != 0.5 || result[1] != -22.5 ||
+            result[2] != 1e300) return -1;
+
+        const bpt::ptree flags = tree()(true)("0")(" false");
+        const boost::array<bool, 3> expected = {true, false, false};
+        if (gpt::toArray<bool, 3>(flags) != expected) return -1;
+
+        // A float is written with the digits of the float, not of a double
+        const float floats[] = {0.1f, 1.0f / 3, -2.5e-30f, 3.4028235e38f, 16777216.0f};
+        const char *texts[] = {"0.1", "0.33333334", "-2.5e-30", "3.4028235e+38", "16777216"};
+        const gpt::arithmetic_translator<std::string, float> float_translator;
+        bpt::ptree float_pt;
+        for (std::size_t i = 0; i < 5; ++i) {
+            bpt::ptree child;
+            child.put_value(floats[i], float_translator);
+            if (child.data() != texts[i]) return -1;
+            float_pt.push_back(std::make_pair("", child));
+        }
+        const std::vector<float> read_floats = gpt::toSequence<std::vector<float> >(float_pt);
+        if (!std::equal(read_floats.begin(), read_floats.end(), floats)) return -1;
+        const bpt::ptree assigned = tree()(0.1f);
+        if (assigned.front().second.data() != "0.1") return -1;
+
+        try {
+            gpt::toSequence<std::vector<int> >(tree()(1)("2x"));
+            return -1;
+        }
+        catch (const bpt::ptree_bad_data &) {
+        }
+    }
+
+    {
+        // All the malformed children are reported at once
+        const bpt::ptree pt = tree()("-9223372036854775808")("x")(3)("")(" 12345678901 ");
+        try {
+            gpt::toSequence<std::vector<long long> >(pt);
+            return -1;
+        }
+        catch (const bpt::ptree_bad_data &e) {
+            const std::vector<std::size_t> bad = e.data<std::vector<std::size_t> >();
+            if (bad.size() != 2 || bad[0] != 1 || bad[1] != 3) return -1;
+        }
+
+        const std::list<double> result =
+            gpt::toSequence<std::list<double> >(tree()("123456.789")(-0.125)("1e-3"));
+        if (result.size() != 3 || result.front() != 123456.789 || result.back() != 1e-3) return -1;
+    }
+
+    {
+        const bpt::ptree pt = tree()("a", 1)("b", "x")("c", 3);
+
+        // The data is converted only when it is reached
+        int sum = 0;
+        std::string names;
+        typedef gpt::key_value<std::string, int> Item;
+        BOOST_FOREACH(const Item &item, gpt::items<int>(pt)) {
+            names += item.first;
+            sum += item.second;
+            break;
+        }
+        if (sum != 1 || names != "a") return -1;
+
+        std::string keys;
+        BOOST_FOREACH(const std::string &key, gpt::keys(pt) | boost::adaptors::reversed) {
+            keys += key;
+        }
+        if (keys != "cba") return -1;
+
+        try {
+            BOOST_FOREACH(int value, gpt::values<int>(pt)) {
+                sum += value;
+            }
+            return -1;
+        }
+        catch (const bpt::ptree_bad_data &) {
+        }
+
+        // A slice leaving out the first and last children
+        const bpt::ptree numbers = tree()("a", 1)("b", 2)("c", 3)("d", 4)("e", 5);
+        sum = 0;
+        BOOST_FOREACH(int value,
+                      boost::make_iterator_range(boost::next(gpt::values<int>(numbers).begin()),
+                                                 boost::prior(gpt::values<int>(numbers).end()))) {
+            sum += value;
+        }
+        if (sum != 2 + 3 + 4) return -1;
+    }
+
+#if defined(__cpp_lib_ranges)
+    {
+        // The lazy ranges compose with the standard views
+        const bpt::ptree pt = tree()("a", 1)("b", 2)("c", 3)("d", 4)("e", 5);
+
+        std::vector<int> odd;
+        for (int value : gpt::values<int>(pt) |
+                 std::views::filter([](int value) { return value % 2 != 0; }) |
+                 std::views::take(2)) {
+            odd.push_back(value);
+        }
+        if (odd != std::vector<int>{1, 3}) return -1;
+
+        std::string keys;
+        for (const std::string &key : gpt::keys(pt) | std::views::reverse) {
+            keys += key;
+        }
+        if (keys != "edcba") return -1;
+
+        std::string tail;
+        for (const auto &item : gpt::items<int>(pt) | std::views::drop(3)) {
+            tail += item.first + std::to_string(item.second);
+        }
+        if (tail != "d4e5") return -1;
+    }
+#endif
+
+#if __cplusplus >= 201103L
+    {
+        bpt::ptree pt;
+        for (int i = 0; i < 100000; ++i) {
+            pt.push_back(bpt::ptree::value_type("", bpt::ptree(i % 3 == 0 ? "1.5" : "-2")));
+        }
+        if (gpt::parallelToSequence<std::vector<double> >(pt, 4) !=
+            gpt::toSequence<std::vector<double> >(pt)) return -1;
+
+        // The error is the same as the one of a conversion in order
+        bpt::ptree::iterator it = pt.begin();
+        std::advance(it, 70000);
+        it->second.data() = "x";
+        std::advance(it, -60000);
+        it->second.data() = "y";
+        try {
+            gpt::parallelToSequence<std::vector<long double> >(pt, 4);
+            return -1;
+        }
+        catch (const bpt::ptree_bad_data &e) {
+            if (e.data<std::string>() != "y") return -1;
+        }
+    }
+#endif
+
+#if defined(__cpp_lib_memory_resource)
+    {
+        // All the strings of the tree are in the arena
+        std::pmr::monotonic_buffer_resource arena;
+        gpt::pmr::default_resource_scope scope(&arena);
+
+        const gpt::pmr::ptree pt = basic_tree<gpt::pmr::ptree>()(1)(2)(3);
+        const std::vector<int> result = gpt::toSequence<std::vector<int> >(pt);
+
+        if (result.size() != 3 || result[2] != 3) return -1;
+
+        const gpt::pmr::ptree named = basic_tree<gpt::pmr::ptree>()("a", 1)("b", 2);
+        const gpt::pmr::ptree other = basic_tree<gpt::pmr::ptree>()("key", "value");
+        const gpt::pmr::ptree merged = gpt::graphUnion(named, other);
+        if (merged.size() != 3 || merged.get<std::pmr::string>("key") != "value" ||
+            merged.get_child("key").data().get_allocator().resource() != &arena)
+            return -1;
+    }
+#endif
+
     return 0;
 }
@@ -7,15 +7,61 @@
  */
 #include <golld/property_tree/assign.hpp>
 #include <golld/property_tree/lua_parser.hpp>
+#include <golld/property_tree/pmr_ptree.hpp>
 #include <golld/property_tree/ptree_io.hpp>
 
+#include <boost/functional/hash.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+#endif
 
 namespace bpt = boost::property_tree;
 namespace gpt = golld::property_tree;
 using namespace golld::property_tree::assign;
 
+#if !defined(_WIN32)
+// Writes a Lua script and sets its modification time
+static void write_script(const std::string &filename, const std::string &text, time_t mtime)
+{
+    std::ofstream(filename.c_str(), std::ios_base::binary) << text;
+    utimbuf times;
+    times.actime = mtime;
+    times.modtime = mtime;
+    utime(filename.c_str(), &times);
+}
+
+// The value v of the root table of a script read through a new cache
+static std::string read_cached(const std::string &directory, const std::string &filename)
+{
+    gpt::lua_chunk_cache cache(directory);
+    bpt::ptree pt;
+    gpt::read_lua(filename, "root", pt, cache);
+    return pt.get<std::string>("v");
+}
+
+static std::size_t count_files(const std::string &directory)
+{
+    std::size_t count = 0;
+    DIR *dir = opendir(directory.c_str());
+    while (dirent *entry = readdir(dir)) {
+        count += entry->d_name[0] != '.';
+    }
+    closedir(dir);
+    return count;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     bpt::ptree pt1 =
@@ -32,5 +78,453 @@ int main(int argc, char *argv[])
     std::cout << "pt1:\n\n" << pt1 << '\n' << std::endl;
     std::cout << "pt2:\n\n" << pt2 << '\n' << std::endl;
 
+    {
+        gpt::lua_state_pool pool(1);
+
+        bpt::ptree pt3;
+        gpt::read_lua("test.lua", "root", pt3, pool);
+        if (pt3 != pt2) return -1;
+
+        std::istringstream script1("root = {a = 1}; leak = 'leak'");
+        gpt::read_lua(script1, "root", pt3, pool);
+
+        // The same state is reused, but without the globals of the last script
+        std::istringstream script2("root = {leak = leak or 'none'}");
+        gpt::read_lua(script2, "root", pt3, pool);
+        if (pt3.get<std::string>("leak") != "none") return -1;
+    }
+
+    {
+        std::istringstream script("root = {'a', 'b', 'c', x = 1, 'd'}");
+        bpt::ptree pt3;
+        gpt::read_lua(script, "root", pt3);
+
+        // The sequence is read in index order, before the other keys
+        const char *keys[] = {"1", "2", "3", "4", "x"};
+        const char *values[] = {"a", "b", "c", "d", "1"};
+        bpt::ptree::const_iterator it = pt3.begin();
+        for (int i = 0; i < 5; ++i, ++it) {
+            if (it->first != keys[i] || it->second.data() != values[i]) return -1;
+        }
+    }
+
+    {
+        // Strings are read with their embedded NULs, numbers in their shortest form
+        std::istringstream script("local zero = 0\n"
+                                  "root = {s = 'a\\0b', a = 0.1, b = 1e300, c = -zero, d = 3}");
+        bpt::ptree pt3;
+        gpt::read_lua(script, "root", pt3);
+        if (pt3.get<std::string>("s") != std::string("a\0b", 3) ||
+            pt3.get<std::string>("a") != "0.1" || pt3.get<std::string>("b") != "1e+300" ||
+            pt3.get<std::string>("c") != "-0" || pt3.get<std::string>("d") != "3") return -1;
+        if (pt3.get<double>("a") != 0.1 || pt3.get<double>("b") != 1e300) return -1;
+    }
+
+    {
+        // A cyclic table is stopped by the maximum depth
+        std::istringstream script("root = {}; root.self = root");
+        bpt::ptree pt3;
+        try {
+            gpt::read_lua(script, "root", pt3);
+            return -1;
+        }
+        catch (const gpt::lua_parser_error &) {
+        }
+    }
+
+    {
+        const char *source =
+            "network = {port = 80}\n"
+            "storage = {path = '/tmp'}\n"
+            "limits = {files = 10}\n";
+
+        std::vector<std::string> keys;
+        keys.push_back("network");
+        keys.push_back("limits");
+
+        bpt::ptree pt3;
+        std::istringstream script1(source);
+        gpt::read_lua_multi(script1, keys, pt3);
+        if (pt3.size() != 2 || pt3.get<int>("network.port") != 80 ||
+            pt3.get<int>("limits.files") != 10) return -1;
+
+        // All the tables created by the script
+        std::istringstream script2(source);
+        gpt::read_lua_multi(script2, std::vector<std::string>(), pt3);
+        if (pt3.size() != 3 || pt3.begin()->first != "limits" ||
+            pt3.get<std::string>("storage.path") != "/tmp") return -1;
+
+        // The values returned by the script are dropped
+        std::istringstream script3("cfg = {a = 1}\nreturn 42, 'x'\n");
+        gpt::read_lua_multi(script3, std::vector<std::string>(), pt3);
+        if (pt3.size() != 1 || pt3.get<int>("cfg.a") != 1) return -1;
+
+        // A root key naming a value which is not a table is an error
+        const char *not_tables[] = {"root = 5", "root = 'abc'", "function root() end"};
+        std::vector<std::string> root(1, "root");
+        for (int i = 0; i < 3; ++i) {
+            try {
+                std::istringstream script4(not_tables[i]);
+                gpt::read_lua(script4, "root", pt3);
+                return -1;
+            }
+            catch (const gpt::lua_parser_error &e) {
+                if (e.message() != "Root key is not a table: root") return -1;
+            }
+            try {
+                std::istringstream script5(not_tables[i]);
+                gpt::read_lua_multi(script5, root, pt3);
+                return -1;
+            }
+            catch (const gpt::lua_parser_error &e) {
+                if (e.message() != "Root key is not a table: root") return -1;
+            }
+        }
+    }
+
+    {
+        gpt::lua_parse_options options;
+        options.libraries = gpt::lua_base_lib;
+        options.use_arena = true;
+
+        bpt::ptree pt3;
+        gpt::read_lua("test.lua", "root", pt3, options);
+        if (pt3 != pt2) return -1;
+
+        // A runaway script is stopped by the memory limit
+        options.memory_limit = 1 << 20;
+        std::istringstream script("root = {}; for i = 1, 1e7 do root[i] = {i} end");
+        try {
+            gpt::read_lua(script, "root", pt3, options);
+            return -1;
+        }
+        catch (const gpt::lua_parser_error &) {
+        }
+    }
+
+    {
+        gpt::lua_chunk_cache cache;
+
+        bpt::ptree pt3;
+        gpt::read_lua("test.lua", "root", pt3, cache);
+        if (pt3 != pt2) return -1;
+
+        // Now from the compiled chunk
+        gpt::read_lua("test.lua", "root", pt3, cache);
+        if (pt3 != pt2) return -1;
+    }
+
+#if !defined(_WIN32)
+    {
+        // The bytecode persisted by a cache is used by another one, while
+        // the file modification time and size are unchanged
+        const std::string directory = "lua_chunk_cache_test";
+        const std::string filename = directory + "/script.lua";
+        mkdir(directory.c_str(), 0700);
+        write_script(filename, "root = {v = 'aaa'}", 1000000000);
+
+        std::ostringstream persisted;
+        persisted << directory << '/' << std::hex << boost::hash<std::string>()(filename)
+                  << ".luac";
+        std::string header;
+        const bool ok1 = read_cached(directory, filename) == "aaa" &&
+            std::getline(std::ifstream(persisted.str().c_str()), header) &&
+            header == "1000000000 18 " + filename && count_files(directory) == 2;
+
+        write_script(filename, "root = {v = 'bbb'}", 1000000000);
+        const bool ok2 = read_cached(directory, filename) == "aaa";
+
+        // Another modification time or size compiles the file again
+        write_script(filename, "root = {v = 'bbb'}", 1000000001);
+        const bool ok3 = read_cached(directory, filename) == "bbb";
+        write_script(filename, "root = {v = 'cccc'}", 1000000001);
+        const bool ok4 = read_cached(directory, filename) == "cccc" &&
+            count_files(directory) == 2;
+
+        std::remove(persisted.str().c_str());
+        std::remove(filename.c_str());
+        rmdir(directory.c_str());
+        if (!ok1 || !ok2 || !ok3 || !ok4) return -1;
+    }
+#endif
+
+    {
+        // A table held by a state owned by the caller
+        lua_State *L = luaL_newstate();
+        luaL_dostring(L, "conf = {name = 'x', sizes = {3, 4}}");
+        lua_getfield(L, LUA_GLOBALSINDEX, "conf");
+
+        bpt::wptree pt3;
+        gpt::read_lua_table(L, -1, pt3);
+        const bool ok = lua_gettop(L) == 1 && pt3.get<std::wstring>(L"name") == L"x" &&
+            pt3.get<int>(L"sizes.2") == 4;
+        lua_close(L);
+        if (!ok) return -1;
+    }
+
+    {
+        // A script reading pt2 without copying it
+        lua_State *L = luaL_newstate();
+        luaL_openlibs(L);
+        gpt::push_ptree(L, pt2);
+        lua_setfield(L, LUA_GLOBALSINDEX, "conf");
+
+        const char *script =
+            "local keys = {}\n"
+            "for k, v in conf() do keys[#keys + 1] = k end\n"
+            "return conf.color .. conf.subtree.leave .. conf.arr[3] .. #conf.arr .. #keys";
+        std::string result;
+        if (luaL_dostring(L, script) == 0) {
+            result = lua_tostring(L, -1);
+        }
+        lua_close(L);
+        if (result != "blueleave1" "33" "8") return -1;
+    }
+
+    {
+        // The same table translated in small steps
+        lua_State *L = luaL_newstate();
+        luaL_dostring(L, "t = {} for i = 1, 1000 do t[i] = {i, name = 'n' .. i} end");
+        lua_getfield(L, LUA_GLOBALSINDEX, "t");
+
+        bpt::ptree whole;
+        gpt::read_lua_table(L, -1, whole);
+
+        bpt::ptree pt3;
+        std::size_t steps = 0;
+        {
+            gpt::lua_table_reader<bpt::ptree> reader(L, pt3);
+            while (!reader.step(100, std::chrono::microseconds(1000))) {
+                ++steps;
+            }
+        }
+        const bool ok = lua_gettop(L) == 1 && steps >= 29 && pt3 == whole;
+        lua_close(L);
+        if (!ok) return -1;
+    }
+
+    {
+        // The sequence keys found again by lua_next are skipped, and count
+        // as steps too
+        lua_State *L = luaL_newstate();
+        luaL_dostring(L, "t = {} for i = 1, 10000 do t[i] = i end");
+        lua_getfield(L, LUA_GLOBALSINDEX, "t");
+
+        bpt::ptree pt3;
+        std::size_t steps = 0;
+        bool ok = true;
+        {
+            gpt::lua_table_reader<bpt::ptree> reader(L, pt3);
+            for (std::size_t nodes = 0; !reader.step(100); nodes = reader.nodes()) {
+                ok = ok && reader.nodes() - nodes <= 100;
+                ++steps;
+            }
+        }
+        ok = ok && lua_gettop(L) == 1 && pt3.size() == 10000 && steps >= 199;
+        lua_close(L);
+        if (!ok) return -1;
+    }
+
+    {
+        // A value which is not a table is rejected before any step
+        lua_State *L = luaL_newstate();
+        lua_pushnumber(L, 5);
+        lua_pushstring(L, "abc");
+        lua_pushnil(L);
+
+        bpt::ptree pt3;
+        int rejected = 0;
+        for (int i = 3; i >= 0; --i) {
+            lua_settop(L, i);
+            try {
+                gpt::lua_table_reader<bpt::ptree> reader(L, pt3);
+                reader.step(100);
+            }
+            catch (const gpt::lua_parser_error &) {
+                rejected += lua_gettop(L) == i;
+            }
+        }
+        lua_close(L);
+        if (rejected != 4 || !pt3.empty()) return -1;
+    }
+
+    {
+        std::vector<gpt::lua_read_job> jobs;
+        for (int i = 0; i < 8; ++i) {
+            jobs.push_back(gpt::lua_read_job(i == 5 ? "missing.lua" : "test.lua", "root"));
+        }
+
+        std::vector<gpt::lua_read_result<bpt::ptree> > results;
+        gpt::read_lua_batch(jobs, results, 3);
+        if (results.size() != jobs.size()) return -1;
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            if (i == 5) {
+                if (!results[i].error || results[i].error->filename() != "missing.lua") return -1;
+            }
+            else if (results[i].error || results[i].tree != pt2) {
+                return -1;
+            }
+        }
+    }
+
+    {
+        // A compact script, read back to the same tree
+        std::ostringstream compact;
+        gpt::write_lua(compact, pt2, false);
+        if (compact.str().find(' ') != std::string::npos) return -1;
+
+        bpt::ptree pt3;
+        std::istringstream script(compact.str());
+        gpt::read_lua(script, "root", pt3);
+        if (pt3.size() != pt2.size() || pt3.get<int>("arr.2") != 2 ||
+            pt3.get<std::string>("subtree.leave") != "leave1") return -1;
+    }
+
+    {
+        // A node with both data and children is not written at all
+        bpt::ptree pt3 = pt2;
+        pt3.put("subtree", "data");
+
+        std::ostringstream output;
+        try {
+            gpt::write_lua(output, pt3);
+            return -1;
+        }
+        catch (const gpt::lua_parser_error &) {
+        }
+        if (!output.str().empty()) return -1;
+    }
+
+    {
+        // Rewritten after each marked change, with the other subtrees cached
+        gpt::lua_serializer<bpt::ptree> serializer(true, 2);
+        bpt::ptree pt3 = pt2;
+        pt3.put_child("copy", pt3.get_child("subtree"));
+        pt3.put_child("deep.a.b", pt3.get_child("arr"));
+
+        // Marks a change and checks the output against write_lua
+        const auto rewritten = [&](const char *path) {
+            serializer.mark_dirty(path);
+            std::ostringstream cached, plain;
+            serializer.write(cached, pt3);
+            gpt::write_lua(plain, pt3);
+            return cached.str() == plain.str();
+        };
+
+        if (!rewritten("")) return -1;
+        pt3.put("subtree.leave", "changed");
+        if (!rewritten("subtree.leave")) return -1;
+        pt3.get_child("deep.a.b").push_back(std::make_pair("", bpt::ptree("4")));
+        if (!rewritten("deep.a.b")) return -1;
+        pt3.get_child("deep.a.b").pop_front();
+        if (!rewritten("deep.a.b")) return -1;
+        pt3.put("copy.more", 1);
+        if (!rewritten("copy.more")) return -1;
+        // The path of an erased node marks its parent
+        pt3.get_child("copy").erase("more");
+        if (!rewritten("copy.more")) return -1;
+        pt3.put_child("deep.a", pt3.get_child("subtree"));
+        if (!rewritten("deep.a")) return -1;
+        pt3.erase("copy");
+        if (!rewritten("")) return -1;
+
+        // An unmarked change is not seen, since the subtree is not read
+        std::ostringstream before;
+        serializer.write(before, pt3);
+        pt3.put("deep.a.b.x", "unmarked");
+
+        std::ostringstream stale, plain;
+        serializer.write(stale, pt3);
+        gpt::write_lua(plain, pt3);
+        if (stale.str() != before.str() || stale.str() == plain.str()) return -1;
+
+        std::ostringstream cleared;
+        serializer.clear();
+        serializer.write(cleared, pt3);
+        if (cleared.str() != plain.str()) return -1;
+    }
+
+    {
+        // A precompiled chunk is read as a script
+        std::stringstream chunk;
+        gpt::write_lua_bytecode(chunk, pt2);
+        if (chunk.str().compare(0, 4, "\033Lua") != 0) return -1;
+
+        bpt::ptree pt3;
+        gpt::read_lua(chunk, "root", pt3);
+        if (pt3.size() != pt2.size() || pt3.get<int>("arr.2") != 2 ||
+            pt3.get<std::string>("color") != "blue") return -1;
+    }
+
+    {
+        // Quotes, backslashes and control characters are escaped
+        const char literal[] = "it's a \\path\\ \"quoted\"\n\r\t\0\x01" "9 and a long tail";
+        std::vector<std::string> values;
+        values.push_back(std::string(literal, sizeof literal - 1));
+
+        // Special characters at and across the ends of 16 and 32 byte blocks
+        const char specials[] = {'\'', '\\', '\n', '\0', '\x1f', '\x7f', '\xff'};
+        const std::size_t positions[] = {0, 1, 14, 15, 16, 17, 30, 31, 32, 33, 47, 63, 64, 70};
+        for (std::size_t i = 0; i < sizeof positions / sizeof positions[0]; ++i) {
+            std::string value(71, 'x');
+            value[positions[i]] = specials[i % sizeof specials];
+            values.push_back(value);
+        }
+        values.push_back(std::string(40, '\0') + std::string(40, '\\') + "1");
+
+        bpt::ptree pt3;
+        pt3.put_value("root");
+        pt3.push_back(std::make_pair("key 'with' quote", bpt::ptree(values[0])));
+        for (std::size_t i = 1; i < values.size(); ++i) {
+            pt3.push_back(std::make_pair(values[i], bpt::ptree(values[i])));
+        }
+
+        std::stringstream script;
+        gpt::write_lua(script, pt3);
+
+        bpt::ptree pt4;
+        gpt::read_lua(script, "root", pt4);
+        // The order of the keys read back is that of the Lua table
+        if (pt4.size() != values.size() ||
+            pt4.get<std::string>("key 'with' quote") != values[0]) return -1;
+        for (std::size_t i = 1; i < values.size(); ++i) {
+            bpt::ptree::const_assoc_iterator it = pt4.find(values[i]);
+            if (it == pt4.not_found() || it->second.data() != values[i]) return -1;
+        }
+    }
+
+#if defined(__cpp_lib_memory_resource)
+    {
+        // A tree of pmr strings read, written and pushed within an arena
+        std::pmr::monotonic_buffer_resource arena;
+        gpt::pmr::default_resource_scope scope(&arena);
+
+        gpt::pmr::ptree pt3;
+        gpt::read_lua("test.lua", "root", pt3);
+        if (pt3.get<std::pmr::string>("subtree.leave") != "leave1" ||
+            pt3.get<int>("arr.3") != 3 ||
+            pt3.get_child("color").data().get_allocator().resource() != &arena)
+            return -1;
+
+        std::stringstream script;
+        gpt::write_lua(script, pt3);
+        gpt::pmr::ptree pt4;
+        gpt::read_lua(script, "root", pt4);
+        if (pt4.get<std::pmr::string>("color") != "blue" ||
+            pt4.get<std::pmr::string>("subtree.leave") != "leave1" ||
+            pt4.get_child("arr").size() != pt3.get_child("arr").size()) return -1;
+
+        lua_State *L = luaL_newstate();
+        gpt::push_ptree(L, pt3);
+        lua_setfield(L, LUA_GLOBALSINDEX, "conf");
+        std::string result;
+        if (luaL_dostring(L, "return conf.color .. conf.subtree.leave .. #conf.arr") == 0) {
+            result = lua_tostring(L, -1);
+        }
+        lua_close(L);
+        if (result != "blueleave13") return -1;
+    }
+#endif
+
     return 0;
 }